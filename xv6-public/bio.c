@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -8,6 +8,9 @@
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
+// * To start reads or writes of several blocks at once, call
+//     bread_async or bwrite_async for each, then bwait for each
+//     before using the data or releasing the buffer.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -21,81 +24,188 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 
-struct
+// Buffers are hashed on (dev, blockno) into NBUCKET lists, each
+// with its own lock and kept in LRU order, so that a lookup only
+// touches one bucket. A miss takes bcache.lock and recycles the
+// least recently used free buffer of some bucket, visiting buckets
+// round-robin from bcache.hand.
+#define NBUCKET 61
+
+struct bucket
 {
   struct spinlock lock;
-  struct buf buf[NBUF];
-
-  // Linked list of all buffers, through prev/next.
+  // Linked list of buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
+};
+
+struct
+{
+  struct spinlock lock; // serializes recycling
+  struct bucket bucket[NBUCKET];
+  int hand;
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+// Insert b at the MRU end of bk. Caller holds bk->lock.
+static void
+bpush(struct bucket* bk, struct buf* b)
+{
+  b->next             = bk->head.next;
+  b->prev             = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next       = b;
+}
+
+static void
+bunlink(struct buf* b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
 void
 binit(void)
 {
-  struct buf* b;
+  struct buf *b, *end;
+  struct bucket* bk;
+  int n;
 
   initlock(&bcache.lock, "bcache");
+  for (bk = bcache.bucket; bk < &bcache.bucket[NBUCKET]; bk++)
+  {
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
 
   // PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for (b = bcache.buf; b < bcache.buf + NBUF; b++)
+  // Carve NBUF buffers out of whole pages and spread them over
+  // the buckets; bget() moves them to where they are needed.
+  for (n = 0; n < NBUF;)
   {
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next       = b;
+    if ((b = (struct buf*)kalloc()) == 0)
+      panic("binit: out of memory");
+    end = b + PGSIZE / sizeof(struct buf);
+    for (; b < end && n < NBUF; b++, n++)
+    {
+      initsleeplock(&b->lock, "buffer");
+      b->dev     = -1;
+      b->blockno = -1;
+      b->flags   = 0;
+      b->refcnt  = 0;
+      bpush(&bcache.bucket[n % NBUCKET], b);
+    }
   }
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Return the buffer for the block if bk caches it, with refcnt
+// incremented. Caller holds bk->lock.
 static struct buf*
-bget(uint dev, uint blockno)
+blookup(struct bucket* bk, uint dev, uint blockno)
 {
   struct buf* b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for (b = bcache.head.next; b != &bcache.head; b = b->next)
+  for (b = bk->head.next; b != &bk->head; b = b->next)
   {
     if (b->dev == dev && b->blockno == blockno)
     {
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for (b = bcache.head.prev; b != &bcache.head; b = b->prev)
+// Take an unused buffer out of its bucket. Caller holds bcache.lock.
+// Even if refcnt==0, B_DIRTY indicates a buffer is in use
+// because log.c has modified it but not yet committed it.
+static struct buf*
+bvictim(void)
+{
+  struct bucket* bk;
+  struct buf* b;
+  int i;
+
+  for (i = 0; i < NBUCKET; i++)
   {
-    if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0)
+    bk          = &bcache.bucket[bcache.hand];
+    bcache.hand = (bcache.hand + 1) % NBUCKET;
+    acquire(&bk->lock);
+    for (b = bk->head.prev; b != &bk->head; b = b->prev)
     {
-      b->dev     = dev;
-      b->blockno = blockno;
-      b->flags   = 0;
-      b->refcnt  = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      if (b->refcnt == 0 && (b->flags & B_DIRTY) == 0)
+      {
+        bunlink(b);
+        release(&bk->lock);
+        return b;
+      }
     }
+    release(&bk->lock);
   }
-  panic("bget: no buffers");
+  return 0;
+}
+
+// Take a free buffer for a block that bk does not cache and put it
+// in bk, with refcnt 1. Caller holds bcache.lock.
+static struct buf*
+bnew(struct bucket* bk, uint dev, uint blockno)
+{
+  struct buf* b;
+
+  if ((b = bvictim()) == 0)
+    return 0;
+  b->dev     = dev;
+  b->blockno = blockno;
+  b->flags   = 0;
+  b->refcnt  = 1;
+  acquire(&bk->lock);
+  bpush(bk, b);
+  release(&bk->lock);
+  return b;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer.
+// In either case, return locked buffer.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct bucket* bk = bhash(dev, blockno);
+  struct buf* b;
+
+  // Is the block already cached?
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if (b)
+  {
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Not cached; recycle an unused buffer. Look again under
+  // bcache.lock in case another process loaded the block meanwhile.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if (!b && (b = bnew(bk, dev, blockno)) == 0)
+    panic("bget: no buffers");
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -112,6 +222,111 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Like bread, but return as soon as the read is queued.
+// Call bwait before looking at the data.
+struct buf*
+bread_async(uint dev, uint blockno)
+{
+  struct buf* b;
+
+  b = bget(dev, blockno);
+  if ((b->flags & B_VALID) == 0)
+  {
+    b->flags |= B_ASYNC;
+    b->done = 0;
+    iderwasync(b);
+  }
+  return b;
+}
+
+// Like bwrite, but return as soon as the write is queued.
+// Call bwait before releasing the buffer.
+void
+bwrite_async(struct buf* b)
+{
+  if (!holdingsleep(&b->lock))
+    panic("bwrite_async");
+  b->flags |= B_DIRTY | B_ASYNC;
+  b->done = 0;
+  iderwasync(b);
+}
+
+// Wait for the request started by bread_async or bwrite_async.
+void
+bwait(struct buf* b)
+{
+  if (!holdingsleep(&b->lock))
+    panic("bwait");
+  iderwwait(b);
+}
+
+// Start reading a block that will probably be needed soon and
+// return without waiting. Does nothing if the block is cached
+// already or no buffer is free.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct bucket* bk = bhash(dev, blockno);
+  struct buf* b;
+
+  // Most blocks a streaming reader asks for are cached already;
+  // only the bucket lock is needed to see that.
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  if (b)
+    b->refcnt--;
+  release(&bk->lock);
+  if (b)
+    return;
+
+  // Look again under bcache.lock, as bget() does.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  if (b)
+    b->refcnt--;
+  release(&bk->lock);
+  if (b || (b = bnew(bk, dev, blockno)) == 0)
+  {
+    release(&bcache.lock);
+    return;
+  }
+  release(&bcache.lock);
+
+  // bget() may have found the new buffer and read it meanwhile.
+  acquiresleep(&b->lock);
+  if (b->flags & B_VALID)
+  {
+    brelse(b);
+    return;
+  }
+  b->flags |= B_ASYNC;
+  b->done = bdone;
+  iderwasync(b);
+}
+
+// Return a locked buf with the contents of the block if the
+// cache holds them, without reading the disk. Otherwise 0.
+struct buf*
+bcached(uint dev, uint blockno)
+{
+  struct bucket* bk = bhash(dev, blockno);
+  struct buf* b;
+
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if (b == 0)
+    return 0;
+  acquiresleep(&b->lock);
+  if ((b->flags & B_VALID) == 0)
+  {
+    brelse(b);
+    return 0;
+  }
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf* b)
@@ -122,8 +337,27 @@ bwrite(struct buf* b)
   iderw(b);
 }
 
+// Drop a reference to an unlocked buffer.
+// Move to the head of its bucket's MRU list.
+static void
+bput(struct buf* b)
+{
+  struct bucket* bk;
+
+  // b cannot be recycled while refcnt > 0, so its bucket is stable.
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0)
+  {
+    // no one is waiting for it.
+    bunlink(b);
+    bpush(bk, b);
+  }
+  release(&bk->lock);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
 void
 brelse(struct buf* b)
 {
@@ -131,21 +365,16 @@ brelse(struct buf* b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0)
-  {
-    // no one is waiting for it.
-    b->next->prev          = b->prev;
-    b->prev->next          = b->next;
-    b->next                = bcache.head.next;
-    b->prev                = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next       = b;
-  }
-
-  release(&bcache.lock);
+// Release a buffer whose asynchronous request has completed.
+// Called by ideintr(), which does not own the buffer's lock.
+void
+bdone(struct buf* b)
+{
+  releasesleep(&b->lock);
+  bput(b);
 }
 // PAGEBREAK!
 // Blank page.
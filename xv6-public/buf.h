@@ -8,7 +8,9 @@ struct buf
   struct buf* prev; // LRU cache list
   struct buf* next;
   struct buf* qnext; // disk queue
+  void (*done)(struct buf*); // B_ASYNC: called by ideintr() when done
   uchar data[BSIZE];
 };
 #define B_VALID 0x2 // buffer has been read from disk
 #define B_DIRTY 0x4 // buffer needs to be written to disk
+#define B_ASYNC 0x8 // ideintr() releases the buffer when it is done
@@ -10,12 +10,22 @@ struct sleeplock;
 struct stat;
 struct superblock;
 struct linked_list;
+struct kmem_cache;
+struct kmemstat;
+struct execseg;
+struct stackbin;
 
 // bio.c
 void binit(void);
 struct buf* bread(uint, uint);
 void brelse(struct buf*);
 void bwrite(struct buf*);
+struct buf* bread_async(uint, uint);
+void bwrite_async(struct buf*);
+void bwait(struct buf*);
+void breadahead(uint, uint);
+struct buf* bcached(uint, uint);
+void bdone(struct buf*);
 
 // console.c
 void consoleinit(void);
@@ -46,6 +56,8 @@ struct inode* idup(struct inode*);
 void iinit(int dev);
 void ilock(struct inode*);
 void iput(struct inode*);
+struct inode* iexec(struct inode*);
+void iexecput(struct inode*);
 void iunlock(struct inode*);
 void iunlockput(struct inode*);
 void iupdate(struct inode*);
@@ -60,6 +72,8 @@ int writei(struct inode*, char*, uint, uint);
 void ideinit(void);
 void ideintr(void);
 void iderw(struct buf*);
+void iderwasync(struct buf*);
+void iderwwait(struct buf*);
 
 // ioapic.c
 void ioapicenable(int irq, int cpu);
@@ -68,7 +82,15 @@ void ioapicinit(void);
 
 // kalloc.c
 char* kalloc(void);
+char* kalloc_zeroed(void);
+char* kalloc_order(int);
+void kfree_order(char*, int);
+void kmemstat(struct kmemstat*);
+int kzeroidle(void);
 void kfree(char*);
+void kref(char*);
+int krefcount(char*);
+uint kfreepages(void);
 void kinit1(void*, void*);
 void kinit2(void*, void*);
 
@@ -82,6 +104,10 @@ extern volatile uint* lapic;
 void lapiceoi(void);
 void lapicinit(void);
 void lapicstartap(uchar, uint);
+void lapicipi(uchar, int);
+uint64 clockus(void);
+int lapictimer(void);
+void lapicdeadline(uint64);
 void microdelay(int);
 
 // log.c
@@ -103,6 +129,7 @@ int pipealloc(struct file**, struct file**);
 void pipeclose(struct pipe*, int);
 int piperead(struct pipe*, char*, int);
 int pipewrite(struct pipe*, char*, int);
+void pipeinit(void);
 
 // PAGEBREAK: 16
 // proc.c
@@ -111,6 +138,8 @@ void exit(void);
 int fork(void);
 int growproc(int);
 int kill(int);
+int setaffinity(int, uint);
+int getaffinity(int);
 struct cpu* mycpu(void);
 struct proc* myproc();
 void pinit(void);
@@ -124,6 +153,12 @@ int wait(void);
 void wakeup(void*);
 void yield(void);
 
+// slab.c
+void slabinit(void);
+struct kmem_cache* kmem_cache_create(char*, uint);
+void* kmem_cache_alloc(struct kmem_cache*);
+void kmem_cache_free(struct kmem_cache*, void*);
+
 // swtch.S
 void swtch(struct context**, struct context*);
 
@@ -180,12 +215,24 @@ pde_t* setupkvm(void);
 char* uva2ka(pde_t*, char*);
 int allocuvm(pde_t*, uint, uint);
 int deallocuvm(pde_t*, uint, uint);
-int allocpageuvm(pde_t*, struct linked_list*, uint, uint);
-int freepageuvm(pde_t*, struct linked_list*, uint, uint);
+void shrinkuvm(pde_t*, uint, uint);
+void stackbininit(void);
+void initstackbin(struct stackbin*);
+void freestackbin(struct stackbin*);
+int allocpageuvm(pde_t*, struct stackbin*, uint, uint);
+int freepageuvm(pde_t*, struct stackbin*, uint, uint, uint);
 void freevm(pde_t*);
 void inituvm(pde_t*, char*, uint);
 int loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t* copyuvm(pde_t*, uint);
+int cowfault(pde_t*, uint);
+int lazyfault(pde_t*, uint, uint);
+void tlback(void);
+struct execseg* execseg(struct proc*, uint);
+int execfault(struct proc*, uint);
+int prefault(uint, uint);
+void textinval(struct inode*);
+void textstat(struct kmemstat*);
 void switchuvm(struct proc*);
 void switchkvm(void);
 int copyout(pde_t*, uint, void*, uint);
@@ -16,7 +16,6 @@ is_pgroup_master(struct proc* p)
 
 extern void change_sched(struct proc*, struct proc*);
 
-void mlfqprint(void);
 int
 exec(char* path, char** argv)
 {
@@ -27,6 +26,9 @@ exec(char* path, char** argv)
   struct inode* ip;
   struct proghdr ph;
   pde_t *pgdir, *oldpgdir;
+  struct inode *execip, *oldip;
+  struct execseg seg[NEXECSEG];
+  int nseg;
   struct proc* curproc = myproc();
 
   pushcli();
@@ -40,7 +42,7 @@ exec(char* path, char** argv)
 
   curproc->pid = curproc->pgid;
   linked_list_init(&curproc->pgroup);
-  linked_list_init(&curproc->stackbin);
+  initstackbin(&curproc->stackbin);
 
   if ((ip = namei(path)) == 0)
   {
@@ -49,7 +51,8 @@ exec(char* path, char** argv)
   }
   
   ilock(ip);
-  pgdir = 0;
+  pgdir  = 0;
+  execip = 0;
 
   // Check ELF header
   if (readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -60,8 +63,10 @@ exec(char* path, char** argv)
   if ((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
-  sz = 0;
+  // Load program into memory. The first NEXECSEG segments are
+  // only recorded; execfault() reads their pages on first touch.
+  sz   = 0;
+  nseg = 0;
   for (i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph))
   {
     if (readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
@@ -72,14 +77,29 @@ exec(char* path, char** argv)
       goto bad;
     if (ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if ((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if (ph.vaddr + ph.memsz >= KERNBASE || ph.vaddr < sz)
       goto bad;
     if (ph.vaddr % PGSIZE != 0)
       goto bad;
+    if (nseg < NEXECSEG)
+    {
+      seg[nseg].vaddr  = ph.vaddr;
+      seg[nseg].memsz  = ph.memsz;
+      seg[nseg].off    = ph.off;
+      seg[nseg].filesz = ph.filesz;
+      nseg++;
+      sz = ph.vaddr + ph.memsz;
+      continue;
+    }
+    if ((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+      goto bad;
     if (loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
-  iunlockput(ip);
+  // Keep the reference to ip for execfault(). Marking it before
+  // unlocking keeps writers from slipping in.
+  execip = iexec(ip);
+  iunlock(ip);
   end_op();
   ip = 0;
 
@@ -120,12 +140,22 @@ exec(char* path, char** argv)
 
   // Commit to the user image.
   oldpgdir         = curproc->pgdir;
+  oldip            = curproc->execip;
   curproc->pgdir   = pgdir;
   curproc->sz      = sz;
+  curproc->execip  = execip;
   curproc->tf->eip = elf.entry; // main
   curproc->tf->esp = sp;
+  memmove(curproc->execseg, seg, sizeof(seg));
+  curproc->nexecseg = nseg;
   switchuvm(curproc);
   freevm(oldpgdir);
+  if (oldip)
+  {
+    begin_op();
+    iexecput(oldip);
+    end_op();
+  }
   return 0;
 
 bad:
@@ -136,5 +166,11 @@ bad:
     iunlockput(ip);
     end_op();
   }
+  if (execip)
+  {
+    begin_op();
+    iexecput(execip);
+    end_op();
+  }
   return -1;
 }
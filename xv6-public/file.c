@@ -14,13 +14,14 @@ struct devsw devsw[NDEV];
 struct
 {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmem_cache* cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -29,18 +30,11 @@ filealloc(void)
 {
   struct file* f;
 
-  acquire(&ftable.lock);
-  for (f = ftable.file; f < ftable.file + NFILE; f++)
-  {
-    if (f->ref == 0)
-    {
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if ((f = kmem_cache_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,10 +63,9 @@ fileclose(struct file* f)
     release(&ftable.lock);
     return;
   }
-  ff      = *f;
-  f->ref  = 0;
-  f->type = FD_NONE;
+  ff = *f;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
 
   if (ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
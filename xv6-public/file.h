@@ -20,6 +20,10 @@ struct inode
   uint dev;              // Device number
   uint inum;             // Inode number
   int ref;               // Reference count
+  int execs;             // References held by running programs
+  struct inode* next;    // icache list, protected by icache.lock
+  struct inode* idleprev; // icache idle list if ref == 0, likewise
+  struct inode* idlenext;
   struct sleeplock lock; // protects everything below here
   int valid;             // inode has been read from disk?
 
@@ -29,6 +33,11 @@ struct inode
   short nlink;
   uint size;
   uint addrs[NDIRECT + 3];
+
+  uint ralast; // last block read by readi()
+  uint raend;  // blocks below this have been read ahead
+  int text;    // textgen names pages of this inode in the text cache
+  uint textgen;
 };
 
 // table mapping major device number to
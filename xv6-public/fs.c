@@ -122,18 +122,22 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to an entry in the inode cache (open
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. Entries are allocated from a slab cache,
+//   so the number of active inodes is limited only by memory.
+//   An entry whose ref reaches zero stays cached, with its
+//   contents and read-ahead state, on an LRU idle list of at
+//   most NIDLEINODE entries; the least recently used ones are
+//   freed beyond that or when free memory runs low.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode on disk.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -157,10 +161,11 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// The icache.lock spin-lock protects the icache list and the
+// allocation of icache entries. Since ip->ref decides when an
+// entry is freed, and ip->dev and ip->inum indicate which i-node
+// an entry holds, one must hold icache.lock while using any of
+// those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -169,19 +174,45 @@ bfree(int dev, uint b)
 struct
 {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct kmem_cache* cache;
+  struct inode* head; // all entries
+  struct inode* idle; // entries with ref == 0, most recently used first
+  struct inode* idletail;
+  int nidle;
 } icache;
 
+// Take ip off the idle list. Caller holds icache.lock.
+static void
+idleremove(struct inode* ip)
+{
+  if (ip->idleprev)
+    ip->idleprev->idlenext = ip->idlenext;
+  else
+    icache.idle = ip->idlenext;
+  if (ip->idlenext)
+    ip->idlenext->idleprev = ip->idleprev;
+  else
+    icache.idletail = ip->idleprev;
+  icache.nidle--;
+}
+
+// Unlink ip from the cache and free it. Caller holds icache.lock.
+static void
+ifree(struct inode* ip)
+{
+  struct inode** pp;
+
+  for (pp = &icache.head; *pp != ip; pp = &(*pp)->next)
+    ;
+  *pp = ip->next;
+  kmem_cache_free(icache.cache, ip);
+}
+
 void
 iinit(int dev)
 {
-  int i = 0;
-
   initlock(&icache.lock, "icache");
-  for (i = 0; i < NINODE; i++)
-  {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  icache.cache = kmem_cache_create("inode", sizeof(struct inode));
 
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
@@ -248,33 +279,37 @@ iupdate(struct inode* ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode* ip;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for (ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++)
+  for (ip = icache.head; ip; ip = ip->next)
   {
-    if (ip->ref > 0 && ip->dev == dev && ip->inum == inum)
+    if (ip->dev == dev && ip->inum == inum)
     {
-      ip->ref++;
+      if (ip->ref++ == 0)
+        idleremove(ip);
       release(&icache.lock);
       return ip;
     }
-    if (empty == 0 && ip->ref == 0) // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if (empty == 0)
+  // Allocate a new inode cache entry.
+  if ((ip = kmem_cache_alloc(icache.cache)) == 0)
     panic("iget: no inodes");
 
-  ip        = empty;
-  ip->dev   = dev;
-  ip->inum  = inum;
-  ip->ref   = 1;
-  ip->valid = 0;
+  initsleeplock(&ip->lock, "inode");
+  ip->dev     = dev;
+  ip->inum    = inum;
+  ip->ref     = 1;
+  ip->execs   = 0;
+  ip->valid   = 0;
+  ip->ralast  = 0;
+  ip->raend   = 0;
+  ip->text    = 0;
+  ip->next    = icache.head;
+  icache.head = ip;
   release(&icache.lock);
 
   return ip;
@@ -291,6 +326,28 @@ idup(struct inode* ip)
   return ip;
 }
 
+// Turn a reference to ip into one held by a running program,
+// whose pages execfault() may still read from ip. writei()
+// refuses to change ip while there are such references.
+struct inode*
+iexec(struct inode* ip)
+{
+  acquire(&icache.lock);
+  ip->execs++;
+  release(&icache.lock);
+  return ip;
+}
+
+// Drop a reference taken with iexec().
+void
+iexecput(struct inode* ip)
+{
+  acquire(&icache.lock);
+  ip->execs--;
+  release(&icache.lock);
+  iput(ip);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -332,8 +389,8 @@ iunlock(struct inode* ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry moves
+// to the idle list, or is freed if it no longer holds an inode.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -359,7 +416,33 @@ iput(struct inode* ip)
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if (--ip->ref == 0)
+  {
+    if (ip->valid)
+    {
+      // Keep it for the next iget() as the most recently used.
+      ip->idleprev = 0;
+      ip->idlenext = icache.idle;
+      if (icache.idle)
+        icache.idle->idleprev = ip;
+      else
+        icache.idletail = ip;
+      icache.idle = ip;
+      icache.nidle++;
+    }
+    else
+      ifree(ip);
+
+    // Give back the least recently used ones over the limit or
+    // under memory pressure.
+    while (icache.idletail &&
+           (icache.nidle > NIDLEINODE || kfreepages() < LOWFREEPAGES))
+    {
+      ip = icache.idletail;
+      idleremove(ip);
+      ifree(ip);
+    }
+  }
   release(&icache.lock);
 }
 
@@ -497,6 +580,8 @@ itrunc(struct inode* ip)
 {
   int i;
 
+  textinval(ip);
+
   for (i = 0; i < NDIRECT; i++)
   {
     if (ip->addrs[i])
@@ -532,12 +617,100 @@ stati(struct inode* ip, struct stat* st)
 }
 
 // PAGEBREAK!
+// Like bmap, but for read-ahead: never allocates and never waits
+// for the disk. Returns 0 if block bn is not allocated, or if an
+// indirect block on the way is not cached; in that case a read of
+// the indirect block is started so that it is there next time.
+static uint
+bmap_cached(struct inode* ip, uint bn)
+{
+  uint addr, idx[3];
+  int depth, i;
+  struct buf* bp;
+
+  if (bn < NDIRECT)
+    return ip->addrs[bn];
+  bn -= NDIRECT;
+
+  // Same indexing as bmap().
+  if (bn < NINDIRECT)
+  {
+    addr   = ip->addrs[NDIRECT];
+    idx[0] = bn;
+    depth  = 1;
+  }
+  else if (bn < NINDIRECT2)
+  {
+    addr   = ip->addrs[NDIRECT + 1];
+    idx[0] = bn / NINDIRECT;
+    idx[1] = bn % NINDIRECT;
+    depth  = 2;
+  }
+  else if (bn < NINDIRECT3)
+  {
+    addr   = ip->addrs[NDIRECT + 2];
+    idx[0] = bn / NINDIRECT2;
+    idx[1] = (bn % NINDIRECT2) / NINDIRECT;
+    idx[2] = bn % NINDIRECT;
+    depth  = 3;
+  }
+  else
+    return 0;
+
+  for (i = 0; i < depth && addr; i++)
+  {
+    if ((bp = bcached(ip->dev, addr)) == 0)
+    {
+      breadahead(ip->dev, addr);
+      return 0;
+    }
+    addr = ((uint*)bp->data)[idx[i]];
+    brelse(bp);
+  }
+  return addr;
+}
+
+// readi() just read blocks first..last of ip. If it is reading the
+// file sequentially, start reading the next NREADAHEAD blocks so that
+// they are in the cache by the time it asks for them.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode* ip, uint first, uint last)
+{
+  uint bn, end, addr;
+
+  if (first != ip->ralast && first != ip->ralast + 1)
+  {
+    // Not continuing the last read: restart the window here, and
+    // only read ahead if this is the start of the file.
+    ip->raend = last + 1;
+    if (first != 0)
+    {
+      ip->ralast = last;
+      return;
+    }
+  }
+  ip->ralast = last;
+
+  end = last + 1 + NREADAHEAD;
+  if (end > (ip->size + BSIZE - 1) / BSIZE)
+    end = (ip->size + BSIZE - 1) / BSIZE;
+  bn = ip->raend > last + 1 ? ip->raend : last + 1;
+  for (; bn < end; bn++)
+  {
+    if ((addr = bmap_cached(ip, bn)) == 0)
+      break;
+    breadahead(ip->dev, addr);
+  }
+  ip->raend = bn;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 int
 readi(struct inode* ip, char* dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, first, last;
   struct buf* bp;
 
   if (ip->type == T_DEV)
@@ -551,7 +724,11 @@ readi(struct inode* ip, char* dst, uint off, uint n)
     return -1;
   if (off + n > ip->size)
     n = ip->size - off;
+  if (n == 0)
+    return 0;
 
+  first = off / BSIZE;
+  last  = (off + n - 1) / BSIZE;
   for (tot = 0; tot < n; tot += m, off += m, dst += m)
   {
     bp = bread(ip->dev, bmap(ip, off / BSIZE));
@@ -559,6 +736,7 @@ readi(struct inode* ip, char* dst, uint off, uint n)
     memmove(dst, bp->data + off % BSIZE, m);
     brelse(bp);
   }
+  readahead(ip, first, last);
   return n;
 }
 
@@ -580,6 +758,9 @@ writei(struct inode* ip, char* src, uint off, uint n)
 
   if (off + n > MAXFILE * BSIZE)
     return -1;
+  // A running program still loads its pages from the file (ETXTBSY).
+  if (ip->execs > 0)
+    return -1;
   if (off > ip->size || off + n < off)
   {
     for (int idx = ip->size / BSIZE; idx < off / BSIZE; ++idx)
@@ -588,6 +769,8 @@ writei(struct inode* ip, char* src, uint off, uint n)
     }
   }
 
+  // Later execs of this file must not get stale cached pages.
+  textinval(ip);
   for (tot = 0; tot < n; tot += m, off += m, src += m)
   {
     bp = bread(ip->dev, bmap(ip, off / BSIZE));
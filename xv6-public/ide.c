@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code. Uses bus-master DMA on a PCI IDE
+// controller when there is one, and PIO otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -19,21 +20,73 @@
 #define IDE_DF      0x20
 #define IDE_ERR     0x01
 
-#define IDE_CMD_READ  0x20
-#define IDE_CMD_WRITE 0x30
-#define IDE_CMD_RDMUL 0xc4
-#define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_READ    0x20
+#define IDE_CMD_WRITE   0x30
+#define IDE_CMD_RDMUL   0xc4
+#define IDE_CMD_WRMUL   0xc5
+#define IDE_CMD_SETMULT 0xc6
+#define IDE_CMD_RDDMA   0xc8
+#define IDE_CMD_WRDMA   0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
+// Most sectors moved by one READ/WRITE MULTIPLE command, and so
+// by one interrupt.
+#define IDE_MAXMULT 16
+// Most bufs moved by one command.
+#define IDE_MAXRUN 32
+
+// PCI configuration space.
+#define PCI_CONFADDR 0xcf8
+#define PCI_CONFDATA 0xcfc
+#define PCI_CMD_IO   0x1
+#define PCI_CMD_BM   0x4
+
+// Bus-master IDE registers of the primary channel, at idebm.
+#define BM_CMD          0
+#define BM_STATUS       2
+#define BM_PRDT         4
+#define BM_CMD_START    0x1
+#define BM_CMD_READ     0x8 // transfer from the disk to memory
+#define BM_STATUS_ERR   0x2
+#define BM_STATUS_INTR  0x4
+#define PRD_EOT         0x8000
+
+// Physical region descriptor: one buf's data for a DMA transfer.
+struct prd
+{
+  uint addr;
+  ushort count;
+  ushort flags;
+};
+
+// idequeue points to the first of the ideactive bufs now being
+// read/written to the disk by one command; they are adjacent
+// blocks. The rest of the queue is sorted as a one-way elevator
+// (C-LOOK): blocks at or above idequeue->blockno in ascending
+// order, then the ones below it, also ascending.
+// idetail points to the last buf in the queue.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf* idequeue;
+static struct buf* idetail;
+static int ideactive;
 
 static int havedisk1;
+static int idemult[2]; // sectors per interrupt set by SET MULTIPLE
 static void idestart(struct buf*);
 
+// Build with IDEDMA=0 to always use PIO.
+#ifndef IDEDMA
+#define IDEDMA 1
+#endif
+
+// I/O base of the bus-master registers, or 0 if there are none.
+static ushort idebm;
+// Transfer with DMA; cleared for good after a DMA error.
+static int idedma;
+// The table must not cross a 64KB boundary.
+static struct prd prdt[IDE_MAXRUN] __attribute__((aligned(256)));
+
 // Wait for IDE disk to become ready.
 static int
 idewait(int checkerr)
@@ -47,6 +100,63 @@ idewait(int checkerr)
   return 0;
 }
 
+// Ask disk dev to move IDE_MAXMULT sectors per interrupt.
+// Keeps one sector per command if the disk refuses.
+static void
+idesetmult(int dev)
+{
+  idemult[dev] = 1;
+  outb(0x1f6, 0xe0 | (dev << 4));
+  idewait(0);
+  outb(0x1f2, IDE_MAXMULT);
+  outb(0x1f7, IDE_CMD_SETMULT);
+  if (idewait(1) >= 0)
+    idemult[dev] = IDE_MAXMULT;
+}
+
+static uint
+pciread(int dev, int func, int off)
+{
+  outl(PCI_CONFADDR, 0x80000000 | (dev << 11) | (func << 8) | off);
+  return inl(PCI_CONFDATA);
+}
+
+static void
+pciwrite(int dev, int func, int off, uint v)
+{
+  outl(PCI_CONFADDR, 0x80000000 | (dev << 11) | (func << 8) | off);
+  outl(PCI_CONFDATA, v);
+}
+
+// Find an IDE controller that can be a bus master on PCI bus 0
+// (the PIIX function that QEMU emulates) and enable its DMA.
+static void
+idedmainit(void)
+{
+  int dev, func;
+  uint class, bar4;
+
+  for (dev = 0; dev < 32; dev++)
+  {
+    for (func = 0; func < 8; func++)
+    {
+      if ((pciread(dev, func, 0x00) & 0xffff) == 0xffff)
+        continue;
+      class = pciread(dev, func, 0x08) >> 8;
+      if ((class >> 8) != 0x0101 || !(class & 0x80))
+        continue;
+      bar4 = pciread(dev, func, 0x20);
+      if (!(bar4 & 1) || (bar4 & 0xfffc) == 0)
+        continue;
+
+      pciwrite(dev, func, 0x04,
+               pciread(dev, func, 0x04) | PCI_CMD_IO | PCI_CMD_BM);
+      idebm = bar4 & 0xfffc;
+      return;
+    }
+  }
+}
+
 void
 ideinit(void)
 {
@@ -67,37 +177,106 @@ ideinit(void)
     }
   }
 
+  // No interrupt for SET MULTIPLE; idestart() enables them.
+  outb(0x3f6, 2);
+  if (havedisk1)
+    idesetmult(1);
+  idesetmult(0);
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0 << 4));
+
+  idedmainit();
+  idedma = IDEDMA && idebm;
+}
+
+// Can b be moved by the same command as the run of n bufs
+// ending with prev?
+static int
+idemergeable(struct buf* prev, struct buf* b, int n)
+{
+  int sector_per_block = BSIZE / SECTOR_SIZE;
+  int max = idedma ? 255 : idemult[prev->dev & 1];
+
+  return b && b->dev == prev->dev && b->blockno == prev->blockno + 1 &&
+         (b->flags & B_DIRTY) == (prev->flags & B_DIRTY) &&
+         n < IDE_MAXRUN && (n + 1) * sector_per_block <= max;
+}
+
+// Point the bus-master engine at the data of the n bufs from b.
+// The data of a buf never crosses a page, so it is contiguous.
+static void
+idedmasetup(struct buf* b, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++, b = b->qnext)
+  {
+    prdt[i].addr  = V2P(b->data);
+    prdt[i].count = BSIZE;
+    prdt[i].flags = 0;
+  }
+  prdt[n - 1].flags = PRD_EOT;
+  outl(idebm + BM_PRDT, V2P(prdt));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Start the request for b and the adjacent bufs queued after it.
+// Caller must hold idelock.
 static void
 idestart(struct buf* b)
 {
+  struct buf* p;
+  int n;
+
   if (b == 0)
     panic("idestart");
   if (b->blockno >= FSSIZE)
     panic("incorrect blockno");
   int sector_per_block = BSIZE / SECTOR_SIZE;
   int sector           = b->blockno * sector_per_block;
-  int read_cmd         = (sector_per_block == 1) ? IDE_CMD_READ : IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   if (sector_per_block > 7)
     panic("idestart");
 
+  // Merge the following adjacent blocks into one command.
+  for (n = 1, p = b; idemergeable(p, p->qnext, n); n++)
+    p = p->qnext;
+  if (p->blockno >= FSSIZE)
+    panic("incorrect blockno");
+  ideactive = n;
+
+  int multi     = idemult[b->dev & 1] > 1;
+  int read_cmd  = multi ? IDE_CMD_RDMUL : IDE_CMD_READ;
+  int write_cmd = multi ? IDE_CMD_WRMUL : IDE_CMD_WRITE;
+
+  if (idedma)
+  {
+    idedmasetup(b, n);
+    outb(idebm + BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_CMD_READ);
+    // Writing 1 clears the error and interrupt bits.
+    outb(idebm + BM_STATUS,
+         inb(idebm + BM_STATUS) | BM_STATUS_ERR | BM_STATUS_INTR);
+    read_cmd  = IDE_CMD_RDDMA;
+    write_cmd = IDE_CMD_WRDMA;
+  }
+
   idewait(0);
-  outb(0x3f6, 0);                // generate interrupt
-  outb(0x1f2, sector_per_block); // number of sectors
+  outb(0x3f6, 0);                    // generate interrupt
+  outb(0x1f2, n * sector_per_block); // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev & 1) << 4) | ((sector >> 24) & 0x0f));
-  if (b->flags & B_DIRTY)
+  if (idedma)
+  {
+    outb(0x1f7, (b->flags & B_DIRTY) ? write_cmd : read_cmd);
+    outb(idebm + BM_CMD, inb(idebm + BM_CMD) | BM_CMD_START);
+  }
+  else if (b->flags & B_DIRTY)
   {
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE / 4);
+    for (p = b; n > 0; n--, p = p->qnext)
+      outsl(0x1f0, p->data, BSIZE / 4);
   }
   else
   {
@@ -109,9 +288,11 @@ idestart(struct buf* b)
 void
 ideintr(void)
 {
-  struct buf* b;
+  struct buf *b, *done[IDE_MAXRUN];
+  void (*fn[IDE_MAXRUN])(struct buf*);
+  int i, n, ok, st;
 
-  // First queued buffer is the active request.
+  // The first ideactive queued buffers are the active request.
   acquire(&idelock);
 
   if ((b = idequeue) == 0)
@@ -119,32 +300,84 @@ ideintr(void)
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
+
+  if (idedma)
+  {
+    // Not from the disk, or the transfer is not finished yet.
+    st = inb(idebm + BM_STATUS);
+    if (!(st & (BM_STATUS_INTR | BM_STATUS_ERR)))
+    {
+      release(&idelock);
+      return;
+    }
+
+    // Stop the engine; the data is already in memory.
+    outb(idebm + BM_CMD, 0);
+    outb(idebm + BM_STATUS, st | BM_STATUS_ERR | BM_STATUS_INTR);
+    if (idewait(1) < 0 || (st & BM_STATUS_ERR))
+    {
+      // Redo the request with PIO, and stay with PIO so that a
+      // broken controller does not fail every request.
+      idedma = 0;
+      cprintf("ide: dma error, using pio\n");
+      idestart(idequeue);
+      release(&idelock);
+      return;
+    }
+  }
 
   // Read data if needed.
-  if (!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE / 4);
+  ok = 1;
+  if (!idedma && !(b->flags & B_DIRTY))
+    ok = idewait(1) >= 0;
+
+  for (n = 0; n < ideactive; n++)
+  {
+    b        = idequeue;
+    idequeue = b->qnext;
+    if (!idedma && !(b->flags & B_DIRTY) && ok)
+      insl(0x1f0, b->data, BSIZE / 4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Wake process waiting for this buf.
+    done[n]  = b;
+    fn[n]    = (b->flags & B_ASYNC) ? b->done : 0;
+    b->done  = 0;
+    b->flags |= B_VALID;
+    b->flags &= ~(B_DIRTY | B_ASYNC);
+    wakeup(b);
+  }
 
   // Start disk on next buf in queue.
   if (idequeue != 0)
     idestart(idequeue);
+  else
+    idetail = 0;
 
   release(&idelock);
+
+  // Run the completion callbacks of asynchronous requests
+  // outside idelock; they may release the bufs.
+  for (i = 0; i < n; i++)
+    if (fn[i])
+      fn[i](done[i]);
 }
 
-// PAGEBREAK!
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf* b)
+// Position of b in the elevator sweep that starts at head.
+static uint
+idesweep(struct buf* head, struct buf* b)
 {
-  struct buf** pp;
+  return b->blockno >= head->blockno ? b->blockno : b->blockno + FSSIZE;
+}
+
+// Insert b into idequeue in elevator order and start the disk if
+// it is idle. Appending past the tail, the usual case for a
+// sequential stream, takes constant time.
+// Caller must hold idelock.
+static void
+ideappend(struct buf* b)
+{
+  struct buf **pp, *p;
+  int i;
 
   if (!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
@@ -153,17 +386,42 @@ iderw(struct buf* b)
   if (b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  acquire(&idelock); // DOC:acquire-lock
-
-  // Append b to idequeue.
   b->qnext = 0;
-  for (pp = &idequeue; *pp; pp = &(*pp)->qnext) // DOC:insert-queue
-    ;
-  *pp = b;
-
-  // Start disk if necessary.
-  if (idequeue == b)
+  if (idequeue == 0)
+  {
+    idequeue = idetail = b;
     idestart(b);
+    return;
+  }
+
+  if (idesweep(idequeue, b) >= idesweep(idequeue, idetail))
+  {
+    idetail->qnext = b;
+    idetail        = b;
+    return;
+  }
+
+  // Skip the active request, then find the first buf after b.
+  for (i = 0, p = idequeue; i < ideactive - 1; i++)
+    p = p->qnext;
+  for (pp = &p->qnext; *pp; pp = &(*pp)->qnext) // DOC:insert-queue
+    if (idesweep(idequeue, *pp) > idesweep(idequeue, b))
+      break;
+  b->qnext = *pp;
+  *pp      = b;
+  if (b->qnext == 0)
+    idetail = b;
+}
+
+// PAGEBREAK!
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf* b)
+{
+  acquire(&idelock); // DOC:acquire-lock
+  ideappend(b);
 
   // Wait for request to finish.
   while ((b->flags & (B_VALID | B_DIRTY)) != B_VALID)
@@ -173,3 +431,28 @@ iderw(struct buf* b)
 
   release(&idelock);
 }
+
+// Queue b like iderw(), but return at once. b must be locked and
+// have B_ASYNC set. When the request completes, ideintr() calls
+// b->done if it is set; otherwise the caller waits with iderwwait().
+void
+iderwasync(struct buf* b)
+{
+  if (!(b->flags & B_ASYNC))
+    panic("iderwasync");
+  acquire(&idelock);
+  ideappend(b);
+  release(&idelock);
+}
+
+// Wait for a request queued by iderwasync() without a callback.
+void
+iderwwait(struct buf* b)
+{
+  acquire(&idelock);
+  while ((b->flags & (B_VALID | B_DIRTY)) != B_VALID)
+  {
+    sleep(b, &idelock);
+  }
+  release(&idelock);
+}
@@ -1,6 +1,7 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates blocks of 2^order 4096-byte pages
+// with a buddy allocator; kalloc() and kfree() handle single pages.
 
 #include "types.h"
 #include "defs.h"
@@ -8,6 +9,27 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "kmemstat.h"
+
+// A free block of order k is 2^k pages aligned to its own size.
+// Its buddy is the block whose page number differs only in bit k;
+// when both are free they are merged into one block of order k+1.
+#define NPAGE    (PHYSTOP / PGSIZE)
+#define PAGEFREE 0x80 // pageorder[]: first page of a free block
+
+// Each CPU keeps a small cache of free pages so that kalloc() and
+// kfree() normally touch only a CPU-local lock. Pages move between a
+// cache and the global free list KBATCH at a time.
+#define KCACHEMAX 64
+#define KBATCH    32
+
+// Idle CPUs keep up to NZEROED pages cleared in advance for
+// kalloc_zeroed().
+#define NZEROED 64
+
+#ifndef KJUNK
+#define KJUNK 1
+#endif
 
 void freerange(void* vstart, void* vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -16,13 +38,28 @@ extern char end[]; // first address after kernel loaded from ELF file
 struct run
 {
   struct run* next;
+  struct run* prev; // only used on the buddy free lists
+};
+
+struct kcache
+{
+  struct spinlock lock;
+  struct run* freelist;
+  int count;
 };
 
 struct
 {
   struct spinlock lock;
   int use_lock;
-  struct run* freelist;
+  struct run* freelist[MAXORDER]; // free blocks of each order
+  uint nfree[MAXORDER];           // length of each freelist
+  uchar pageorder[NPAGE];         // order | PAGEFREE of free blocks
+  struct run* zeroed;             // pages that are all zero except for next
+  int nzeroed;
+  struct spinlock reflock;
+  ushort pageref[NPAGE]; // references beyond the first (copy-on-write)
+  struct kcache cache[NCPU];
 } kmem;
 
 // Initialization happens in two phases.
@@ -34,6 +71,9 @@ void
 kinit1(void* vstart, void* vend)
 {
   initlock(&kmem.lock, "kmem");
+  initlock(&kmem.reflock, "kref");
+  for (int i = 0; i < NCPU; i++)
+    initlock(&kmem.cache[i].lock, "kcache");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -45,6 +85,83 @@ kinit2(void* vstart, void* vend)
   kmem.use_lock = 1;
 }
 
+// Remove free block r of the given order from its list.
+// Caller holds kmem.lock.
+static void
+buddyunlink(struct run* r, int order)
+{
+  if (r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if (r->next)
+    r->next->prev = r->prev;
+  kmem.nfree[order]--;
+}
+
+static void
+buddypush(uint pfn, int order)
+{
+  struct run* r = (struct run*)P2V(pfn * PGSIZE);
+
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if (r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.pageorder[pfn]  = order | PAGEFREE;
+  kmem.nfree[order]++;
+}
+
+// Return a block to the free lists, merging it with its buddy
+// for as long as the buddy is free too.
+// Caller holds kmem.lock.
+static void
+buddyfree(char* v, int order)
+{
+  uint pfn = V2P(v) / PGSIZE;
+  uint buddy;
+
+  for (; order < MAXORDER - 1; order++)
+  {
+    buddy = pfn ^ (1 << order);
+    if (buddy >= NPAGE || kmem.pageorder[buddy] != (order | PAGEFREE))
+      break;
+    buddyunlink((struct run*)P2V(buddy * PGSIZE), order);
+    kmem.pageorder[buddy] = 0;
+    pfn &= ~(1 << order);
+  }
+  buddypush(pfn, order);
+}
+
+// Take a block of the given order, splitting a larger one if needed.
+// Caller holds kmem.lock.
+static char*
+buddyalloc(int order)
+{
+  struct run* r;
+  uint pfn;
+  int o;
+
+  for (o = order; o < MAXORDER && !kmem.freelist[o]; o++)
+    ;
+  if (o == MAXORDER)
+    return 0;
+
+  r = kmem.freelist[o];
+  buddyunlink(r, o);
+  pfn                 = V2P(r) / PGSIZE;
+  kmem.pageorder[pfn] = 0;
+
+  // Give back the upper half until the block has the right size.
+  while (o > order)
+  {
+    o--;
+    buddypush(pfn + (1 << o), o);
+  }
+  return (char*)r;
+}
+
 void
 freerange(void* vstart, void* vend)
 {
@@ -53,6 +170,90 @@ freerange(void* vstart, void* vend)
   for (; p + PGSIZE <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+
+// Lock and return this CPU's page cache.
+static struct kcache*
+lockcache(void)
+{
+  struct kcache* c;
+
+  pushcli();
+  c = &kmem.cache[cpuid()];
+  acquire(&c->lock);
+  popcli();
+  return c;
+}
+
+// Move up to n pages from c to the buddy free lists.
+// Caller holds c->lock.
+static void
+drain(struct kcache* c, int n)
+{
+  struct run* r;
+
+  acquire(&kmem.lock);
+  for (; n > 0 && c->freelist; n--)
+  {
+    r           = c->freelist;
+    c->freelist = r->next;
+    buddyfree((char*)r, 0);
+    c->count--;
+  }
+  release(&kmem.lock);
+}
+
+// Move up to n pages from the buddy free lists to c.
+// Caller holds c->lock.
+static void
+refill(struct kcache* c, int n)
+{
+  struct run* r;
+
+  acquire(&kmem.lock);
+  for (; n > 0 && (r = (struct run*)buddyalloc(0)); n--)
+  {
+    r->next     = c->freelist;
+    c->freelist = r;
+    c->count++;
+  }
+  release(&kmem.lock);
+}
+
+// Give every cached page back to the buddy lists so that it can
+// be merged into larger blocks.
+static void
+flush(void)
+{
+  struct kcache* c;
+
+  for (c = kmem.cache; c < &kmem.cache[NCPU]; c++)
+  {
+    acquire(&c->lock);
+    drain(c, c->count);
+    release(&c->lock);
+  }
+}
+
+// The buddy lists are empty: take a page cached by another CPU.
+static struct run*
+steal(void)
+{
+  struct kcache* c;
+  struct run* r = 0;
+
+  for (c = kmem.cache; c < &kmem.cache[NCPU] && !r; c++)
+  {
+    acquire(&c->lock);
+    if ((r = c->freelist))
+    {
+      c->freelist = r->next;
+      c->count--;
+    }
+    release(&c->lock);
+  }
+  return r;
+}
+
 // PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
@@ -62,20 +263,41 @@ void
 kfree(char* v)
 {
   struct run* r;
+  struct kcache* c;
 
   if ((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  // A shared page is only freed by its last reference.
+  if (kmem.use_lock && kmem.pageref[V2P(v) / PGSIZE])
+  {
+    acquire(&kmem.reflock);
+    if (kmem.pageref[V2P(v) / PGSIZE])
+    {
+      kmem.pageref[V2P(v) / PGSIZE]--;
+      release(&kmem.reflock);
+      return;
+    }
+    release(&kmem.reflock);
+  }
+
   // Fill with junk to catch dangling refs.
-  memset(v, 1, PGSIZE);
+  if (KJUNK)
+    memset(v, 1, PGSIZE);
 
-  if (kmem.use_lock)
-    acquire(&kmem.lock);
-  r             = (struct run*)v;
-  r->next       = kmem.freelist;
-  kmem.freelist = r;
-  if (kmem.use_lock)
-    release(&kmem.lock);
+  r = (struct run*)v;
+  if (!kmem.use_lock)
+  {
+    buddyfree(v, 0);
+    return;
+  }
+
+  c           = lockcache();
+  r->next     = c->freelist;
+  c->freelist = r;
+  if (++c->count > KCACHEMAX)
+    drain(c, KBATCH);
+  release(&c->lock);
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -85,13 +307,184 @@ char*
 kalloc(void)
 {
   struct run* r;
+  struct kcache* c;
+
+  if (!kmem.use_lock)
+    return buddyalloc(0);
+
+  c = lockcache();
+  if (!c->freelist)
+    refill(c, KBATCH);
+  r = c->freelist;
+  if (r)
+  {
+    c->freelist = r->next;
+    c->count--;
+  }
+  release(&c->lock);
+
+  if (!r)
+    r = steal();
+  if (!r)
+  {
+    acquire(&kmem.lock);
+    if ((r = kmem.zeroed))
+    {
+      kmem.zeroed = r->next;
+      kmem.nzeroed--;
+    }
+    release(&kmem.lock);
+  }
+  return (char*)r;
+}
+
+// Add a reference to page v. Every reference is dropped by
+// one kfree(); the last one frees the page.
+void
+kref(char* v)
+{
+  acquire(&kmem.reflock);
+  kmem.pageref[V2P(v) / PGSIZE]++;
+  release(&kmem.reflock);
+}
+
+// Number of free pages, including cached and pre-zeroed ones.
+// Read without locks, so only an estimate.
+uint
+kfreepages(void)
+{
+  uint n = kmem.nzeroed;
+
+  for (int o = 0; o < MAXORDER; o++)
+    n += kmem.nfree[o] << o;
+  for (int i = 0; i < NCPU; i++)
+    n += kmem.cache[i].count;
+  return n;
+}
+
+// Number of references to page v.
+int
+krefcount(char* v)
+{
+  return kmem.pageref[V2P(v) / PGSIZE] + 1;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. Returns 0 if no such block is free.
+char*
+kalloc_order(int order)
+{
+  char* v;
+
+  if (order < 0 || order >= MAXORDER)
+    panic("kalloc_order");
+  if (order == 0)
+    return kalloc();
 
   if (kmem.use_lock)
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if (r)
-    kmem.freelist = r->next;
+  v = buddyalloc(order);
   if (kmem.use_lock)
     release(&kmem.lock);
-  return (char*)r;
+
+  // Pages held in the per-CPU caches may complete a block.
+  if (!v && kmem.use_lock)
+  {
+    flush();
+    acquire(&kmem.lock);
+    v = buddyalloc(order);
+    release(&kmem.lock);
+  }
+  return v;
+}
+
+// Free a block returned by kalloc_order(order).
+void
+kfree_order(char* v, int order)
+{
+  if (order < 0 || order >= MAXORDER ||
+      (uint)v % (PGSIZE << order) || v < end ||
+      V2P(v) + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_order");
+  if (order == 0)
+  {
+    kfree(v);
+    return;
+  }
+
+  if (KJUNK)
+    memset(v, 1, PGSIZE << order);
+
+  if (kmem.use_lock)
+    acquire(&kmem.lock);
+  buddyfree(v, order);
+  if (kmem.use_lock)
+    release(&kmem.lock);
+}
+
+// Report the number of free blocks of each order.
+void
+kmemstat(struct kmemstat* st)
+{
+  struct kcache* c;
+
+  memset(st, 0, sizeof(*st));
+  acquire(&kmem.lock);
+  for (int o = 0; o < MAXORDER; o++)
+    st->nfree[o] = kmem.nfree[o];
+  st->zeroed = kmem.nzeroed;
+  release(&kmem.lock);
+
+  for (c = kmem.cache; c < &kmem.cache[NCPU]; c++)
+    st->cached += c->count;
+}
+
+// Allocate one page filled with zeros.
+// Takes a page cleared by an idle CPU if there is one.
+char*
+kalloc_zeroed(void)
+{
+  struct run* r = 0;
+  char* mem;
+
+  if (kmem.use_lock)
+  {
+    acquire(&kmem.lock);
+    if ((r = kmem.zeroed))
+    {
+      kmem.zeroed = r->next;
+      kmem.nzeroed--;
+    }
+    release(&kmem.lock);
+  }
+  if (r)
+  {
+    r->next = 0;
+    return (char*)r;
+  }
+
+  if ((mem = kalloc()) != 0)
+    memset(mem, 0, PGSIZE);
+  return mem;
+}
+
+// Called by an idle CPU. Clears one page for kalloc_zeroed().
+// Returns 1 if it did some work, 0 if the pool is already full.
+int
+kzeroidle(void)
+{
+  struct run* r;
+
+  if (!kmem.use_lock || kmem.nzeroed >= NZEROED)
+    return 0;
+  if ((r = (struct run*)kalloc()) == 0)
+    return 0;
+
+  memset(r, 0, PGSIZE);
+  acquire(&kmem.lock);
+  r->next     = kmem.zeroed;
+  kmem.zeroed = r;
+  kmem.nzeroed++;
+  release(&kmem.lock);
+  return 1;
 }
@@ -0,0 +1,12 @@
+// kmemstat으로 읽는 physical page allocator 상태
+// order k인 block은 2^k개의 연속된 page이다
+#define MAXORDER 11 // 가장 큰 block은 2^10 page (4MB)
+
+struct kmemstat
+{
+  uint nfree[MAXORDER]; // order별 free block의 수
+  uint cached;          // cpu별 cache에 있는 page의 수
+  uint zeroed;          // 미리 0으로 지워둔 page의 수
+  uint texthit;         // text cache에서 찾은 실행 파일 page의 수
+  uint textmiss;        // 파일에서 읽어 text cache에 넣은 page의 수
+};
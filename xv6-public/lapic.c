@@ -9,6 +9,7 @@
 #include "traps.h"
 #include "mmu.h"
 #include "x86.h"
+#include "proc.h"
 
 // Local APIC registers, divided by 4 for use as uint[] indices.
 #define ID       (0x0020 / 4) // ID
@@ -31,6 +32,7 @@
 #define ICRHI    (0x0310 / 4) // Interrupt Command [63:32]
 #define TIMER    (0x0320 / 4) // Local Vector Table 0 (TIMER)
 #define X1       0x0000000B   // divide counts by 1
+#define ONESHOT  0x00000000   // One-shot
 #define PERIODIC 0x00020000   // Periodic
 #define PCINT    (0x0340 / 4) // Performance Counter LVT
 #define LINT0    (0x0350 / 4) // Local Vector Table 1 (LINT0)
@@ -43,6 +45,27 @@
 
 volatile uint* lapic; // Initialized in mp.c
 
+// PIT channel 2, used once at boot to calibrate the TSC and the
+// lapic timer. Its gate is controlled through the keyboard
+// controller's port B.
+#define PIT_CH2    0x42
+#define PIT_MODE   0x43
+#define PIT_PORTB  0x61
+#define PIT_HZ     1193182
+#define CALIBUS    10000 // calibration interval in microseconds
+
+static uint tscperus;   // TSC cycles per microsecond
+static uint lapicperus; // lapic timer counts per microsecond, rounded up
+
+// Per-cpu timer state; each cpu programs its own lapic timer
+// in one-shot mode for the earlier of its next tick and the
+// scheduler's deadline.
+static struct
+{
+  uint64 nexttick; // clockus() of the next clock tick
+  uint64 deadline; // end of the current time slice, or 0
+} timers[NCPU];
+
 // PAGEBREAK!
 static void
 lapicw(int index, int value)
@@ -51,6 +74,121 @@ lapicw(int index, int value)
   lapic[ID]; // wait for write to finish, by reading
 }
 
+// Index of this cpu in cpus[]. Unlike cpuid() this works before
+// the cpu's own segments are set up.
+static int
+cpuindex(void)
+{
+  int apicid = lapicid();
+
+  for (int i = 0; i < ncpu; ++i)
+    if (cpus[i].apicid == apicid)
+      return i;
+  return 0;
+}
+
+// Count the TSC and the lapic timer across CALIBUS microseconds
+// of PIT channel 2 in one-shot mode (mode 0).
+static void
+calibrate(void)
+{
+  uint latch = PIT_HZ / (1000000 / CALIBUS);
+  uint64 t0, t1;
+  uint count;
+
+  // Gate high, speaker off.
+  outb(PIT_PORTB, (inb(PIT_PORTB) & ~0x02) | 0x01);
+  outb(PIT_MODE, 0xB0); // channel 2, lobyte/hibyte, mode 0
+  outb(PIT_CH2, latch & 0xFF);
+  outb(PIT_CH2, latch >> 8);
+
+  lapicw(TIMER, MASKED | ONESHOT);
+  lapicw(TICR, 0xFFFFFFFF);
+  t0 = rdtsc();
+  for (uint spin = 0; !(inb(PIT_PORTB) & 0x20); ++spin)
+    if (spin > 100000000)
+      return; // no PIT; keep the periodic timer
+  t1    = rdtsc();
+  count = 0xFFFFFFFF - lapic[TCCR];
+  lapicw(TICR, 0);
+
+  tscperus   = divu64(t1 - t0, CALIBUS);
+  lapicperus = (count + CALIBUS - 1) / CALIBUS;
+}
+
+// Arm the one-shot timer to fire us microseconds from now,
+// rounding up so that it never fires before the deadline.
+static void
+lapicarm(uint64 us)
+{
+  if (us > 0xFFFFFFFF / lapicperus - 1)
+    us = 0xFFFFFFFF / lapicperus - 1;
+  lapicw(TICR, ((uint)us + 1) * lapicperus);
+}
+
+// Program this cpu's timer for the earlier of its next tick and
+// its deadline. Caller must have interrupts disabled.
+static void
+lapicrearm(void)
+{
+  int cpu     = cpuindex();
+  uint64 now  = clockus();
+  uint64 when = timers[cpu].nexttick;
+
+  if (timers[cpu].deadline && timers[cpu].deadline < when)
+    when = timers[cpu].deadline;
+  lapicarm(when > now ? when - now : 0);
+}
+
+// Microseconds since boot, from the TSC. The TSCs of all cpus
+// are assumed to be synchronized.
+uint64
+clockus(void)
+{
+  if (!tscperus)
+    return (uint64)ticks * TICKUS;
+  return divu64(rdtsc(), tscperus);
+}
+
+// Called on every lapic timer interrupt with interrupts disabled.
+// Re-arms the timer and returns 1 if a clock tick has elapsed.
+int
+lapictimer(void)
+{
+  int tick = 1;
+
+  if (tscperus && lapicperus)
+  {
+    int cpu    = cpuindex();
+    uint64 now = clockus();
+
+    tick = now >= timers[cpu].nexttick;
+    if (tick)
+    {
+      timers[cpu].nexttick += TICKUS;
+      if (timers[cpu].nexttick <= now)
+        timers[cpu].nexttick = now + TICKUS;
+    }
+    if (timers[cpu].deadline && timers[cpu].deadline <= now)
+      timers[cpu].deadline = 0;
+    lapicrearm();
+  }
+  return tick;
+}
+
+// Ask for a timer interrupt at clockus() == us, in addition to the
+// regular clock ticks. 0 clears the deadline. Caller must have
+// interrupts disabled.
+void
+lapicdeadline(uint64 us)
+{
+  if (!tscperus || !lapicperus)
+    return;
+  timers[cpuindex()].deadline = us;
+  if (us)
+    lapicrearm();
+}
+
 void
 lapicinit(void)
 {
@@ -60,13 +198,25 @@ lapicinit(void)
   // Enable local APIC; set spurious interrupt vector.
   lapicw(SVR, ENABLE | (T_IRQ0 + IRQ_SPURIOUS));
 
-  // The timer repeatedly counts down at bus frequency
-  // from lapic[TICR] and then issues an interrupt.
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
+  // The timer counts down at bus frequency from lapic[TICR]
+  // and then issues an interrupt. It is calibrated against the
+  // PIT once, then run in one-shot mode and re-armed by
+  // lapictimer() for the next tick or time slice deadline.
   lapicw(TDCR, X1);
-  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  if (!tscperus)
+    calibrate();
+  if (tscperus && lapicperus)
+  {
+    timers[cpuindex()].nexttick = clockus() + TICKUS;
+    timers[cpuindex()].deadline = 0;
+    lapicw(TIMER, ONESHOT | (T_IRQ0 + IRQ_TIMER));
+    lapicarm(TICKUS);
+  }
+  else
+  {
+    lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+    lapicw(TICR, 10000000);
+  }
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -120,6 +270,16 @@ microdelay(int us)
 {
 }
 
+// Send a fixed interrupt with the given vector to one cpu.
+void
+lapicipi(uchar apicid, int vector)
+{
+  while (lapic[ICRLO] & DELIVS)
+    ;
+  lapicw(ICRHI, apicid << 24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+}
+
 #define CMOS_PORT   0x70
 #define CMOS_RETURN 0x71
 
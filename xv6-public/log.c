@@ -69,20 +69,26 @@ initlog(int dev)
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// All the writes are queued before waiting for any of them.
 static void
 install_trans(void)
 {
+  struct buf* dbuf[LOGSIZE];
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++)
   {
     struct buf* lbuf = bread(log.dev, log.start + tail + 1); // read log block
-    struct buf* dbuf = bread(log.dev, log.lh.block[tail]);   // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE); // copy block to dst
-    bwrite(dbuf);                           // write dst to disk
+    dbuf[tail]       = bread(log.dev, log.lh.block[tail]);   // read dst
+    memmove(dbuf[tail]->data, lbuf->data, BSIZE); // copy block to dst
+    bwrite_async(dbuf[tail]);                     // write dst to disk
     brelse(lbuf);
-    brelse(dbuf);
+  }
+  for (tail = 0; tail < log.lh.n; tail++)
+  {
+    bwait(dbuf[tail]);
+    brelse(dbuf[tail]);
   }
 }
 
@@ -192,19 +198,25 @@ end_op(void)
 }
 
 // Copy modified blocks from cache to log.
+// All the writes are queued before waiting for any of them.
 static void
 write_log(void)
 {
+  struct buf* to[LOGSIZE];
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++)
   {
-    struct buf* to   = bread(log.dev, log.start + tail + 1); // log block
+    to[tail]         = bread(log.dev, log.start + tail + 1); // log block
     struct buf* from = bread(log.dev, log.lh.block[tail]);   // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to); // write the log
+    memmove(to[tail]->data, from->data, BSIZE);
+    bwrite_async(to[tail]); // write the log
     brelse(from);
-    brelse(to);
+  }
+  for (tail = 0; tail < log.lh.n; tail++)
+  {
+    bwait(to[tail]);
+    brelse(to[tail]);
   }
 }
 
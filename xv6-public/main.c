@@ -29,7 +29,10 @@ main(void)
   pinit();                                    // process table
   tvinit();                                   // trap vectors
   binit();                                    // buffer cache
+  slabinit();                                 // kernel object caches
   fileinit();                                 // file table
+  pipeinit();                                 // pipe buffers
+  stackbininit();                             // free thread stack ranges
   ideinit();                                  // disk
   startothers();                              // start other processors
   kinit2(P2V(4 * 1024 * 1024), P2V(PHYSTOP)); // must come after startothers()
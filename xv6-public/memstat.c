@@ -0,0 +1,37 @@
+// physical page allocator의 상태를 출력한다
+// frag_pct: 그 order의 block을 할당할 수 없는 작은 block에 묶인 free page의 비율
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "kmemstat.h"
+
+int
+main(int argc, char* argv[])
+{
+  struct kmemstat st;
+  uint pages = 0;
+
+  if (kmemstat(&st) < 0)
+  {
+    printf(2, "memstat: kmemstat failed\n");
+    exit();
+  }
+
+  for (int order = 0; order < MAXORDER; ++order)
+  {
+    pages += st.nfree[order] << order;
+  }
+
+  uint below = 0;
+  for (int order = 0; order < MAXORDER; ++order)
+  {
+    printf(1, "order %d free %d frag_pct %d\n", order, st.nfree[order],
+           pages ? below * 100 / pages : 0);
+    below += st.nfree[order] << order;
+  }
+  printf(1, "free_pages %d cached %d zeroed %d\n", pages, st.cached,
+         st.zeroed);
+  printf(1, "text_hit %d text_miss %d\n", st.texthit, st.textmiss);
+  exit();
+}
@@ -45,6 +45,7 @@ void rinode(uint inum, struct dinode* ip);
 void rsect(uint sec, void* buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void* p, int n);
+uint indalloc(uint addr, uint index);
 
 // convert to intel byte order
 ushort
@@ -266,6 +267,21 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return entry index of indirect block addr, allocating it if needed.
+uint
+indalloc(uint addr, uint index)
+{
+  uint indirect[NINDIRECT];
+
+  rsect(addr, (char*)indirect);
+  if (indirect[index] == 0)
+  {
+    indirect[index] = xint(freeblock++);
+    wsect(addr, (char*)indirect);
+  }
+  return xint(indirect[index]);
+}
+
 void
 iappend(uint inum, void* xp, int n)
 {
@@ -273,7 +289,6 @@ iappend(uint inum, void* xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -291,19 +306,25 @@ iappend(uint inum, void* xp, int n)
       }
       x = xint(din.addrs[fbn]);
     }
-    else
+    else if (fbn - NDIRECT < NINDIRECT)
     {
       if (xint(din.addrs[NDIRECT]) == 0)
       {
         din.addrs[NDIRECT] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if (indirect[fbn - NDIRECT] == 0)
+      x = indalloc(xint(din.addrs[NDIRECT]), fbn - NDIRECT);
+    }
+    else
+    {
+      // Same layout as the kernel's bmap: the pointer block index
+      // is taken from fbn - NDIRECT without removing NINDIRECT.
+      assert(fbn - NDIRECT < NINDIRECT2);
+      if (xint(din.addrs[NDIRECT + 1]) == 0)
       {
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+        din.addrs[NDIRECT + 1] = xint(freeblock++);
       }
-      x = xint(indirect[fbn - NDIRECT]);
+      x = indalloc(xint(din.addrs[NDIRECT + 1]), (fbn - NDIRECT) / NINDIRECT);
+      x = indalloc(x, (fbn - NDIRECT) % NINDIRECT);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -99,10 +99,15 @@ struct segdesc
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE - 1))
 
 // Page table/directory entry flags.
-#define PTE_P  0x001 // Present
-#define PTE_W  0x002 // Writeable
-#define PTE_U  0x004 // User
-#define PTE_PS 0x080 // Page Size
+#define PTE_P   0x001 // Present
+#define PTE_W   0x002 // Writeable
+#define PTE_U   0x004 // User
+#define PTE_PS  0x080 // Page Size
+#define PTE_COW 0x200 // Copy-on-write (bit available to software)
+
+// Page fault error code bits.
+#define FEC_P  0x001 // Fault on a present page (protection violation)
+#define FEC_WR 0x002 // Fault was caused by a write
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)  ((uint)(pte) & ~0xFFF)
@@ -2,14 +2,27 @@
 #define KSTACKSIZE    4096 // size of per-process kernel stack
 #define NCPU          8    // maximum number of CPUs
 #define NOFILE        64   // open files per process
-#define NFILE         1000 // open files per system
-#define NINODE        50   // maximum number of active i-nodes
 #define NDEV          10   // maximum major device number
 #define ROOTDEV       1    // device number of file system root disk
 #define MAXARG        32   // max exec arguments
 #define MAXOPBLOCKS   10   // max # of blocks any FS op writes
 #define LOGSIZE       (MAXOPBLOCKS * 3) // max data blocks in on-disk log
-#define NBUF          (MAXOPBLOCKS * 3) // size of disk block cache
+#ifndef NBUF
+#define NBUF          512  // size of disk block cache
+#endif
+// commit pins a log buffer per block as well as the cached data blocks
+#if NBUF < 2 * LOGSIZE + MAXOPBLOCKS
+#error "NBUF too small for a log commit"
+#endif
+#define NIDLEINODE    64 // unreferenced inodes kept in the inode cache
+#define LOWFREEPAGES  256 // fewer free pages than this is memory pressure
 #define FSSIZE        40000              // size of file system in blocks
+#define TICKUS        10000 // length of a clock tick in microseconds
 #define NLEVEL        3
-#define MLFQMINTICKET 20
\ No newline at end of file
+#define MLFQMINTICKET 20
+#define NEXECSEG      4 // ELF segments loaded on demand per process
+#define EXECREADAHEAD 3 // pages read after a faulting executable page
+#define NTEXTPAGE     128 // executable pages shared between processes
+#define UNMAPBATCH    32 // pages unmapped per TLB shootdown
+#define NSTACKCLASS   5   // size classes of free thread stack ranges
+#define NREADAHEAD    8   // blocks read ahead of a sequential reader
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "proc.h"
 #include "spinlock.h"
 #include "scheduler.h"
+#include "schedtrace.h"
 
 struct
 {
@@ -22,20 +23,24 @@ struct clone_args
   void* (*start_routine)(void*);
   void* args;
   struct spinlock* lock;
+  uint stackpages; // CLONE_THREAD: guard page를 포함한 stack의 크기
 };
 
+#define THREADSTACK 1 // thread stack의 기본 크기 (page)
+
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 extern int sys_uptime(void);
 
 static void wakeup1(void* chan);
+static void pgroup_quiesce(struct proc*);
 int ps(void);
 void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
-  mlfqinit();
+  schedinit();
 }
 
 void
@@ -121,6 +126,41 @@ is_pgroup_have_pid(struct proc* node, int pid)
   return 0;
 }
 
+// p를 RUNNABLE로 만들고, p의 pgroup이 parked 상태라면 run queue로 돌려놓음
+// ptable.lock을 잡은 상태에서 호출해야 한다
+static void
+setrunnable(struct proc* p)
+{
+  p->state = RUNNABLE;
+  schedtrace(TRACE_WAKEUP, p, 0);
+  schedwakeup(p);
+}
+
+// lwp가 cpu에서 실행되기 시작함을 기록한다
+static void
+tracedispatch(struct proc* lwp)
+{
+  struct proc* master = lwp->pgroup_master;
+  schedtrace(TRACE_DISPATCH, lwp,
+             (master->schedule.sched == SCHEDSTRIDE) ? master->schedule.ticket
+                                                     : 0);
+}
+
+// lwp가 cpu에서 내려왔음을 기록한다
+// 잠든 경우는 sleep()에서 이미 기록했다
+static void
+traceswitchout(struct proc* lwp)
+{
+  if (lwp->state == RUNNABLE)
+  {
+    schedtrace(TRACE_PREEMPT, lwp, 0);
+  }
+  else if (lwp->state == ZOMBIE)
+  {
+    schedtrace(TRACE_EXIT, lwp, 0);
+  }
+}
+
 // PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
@@ -155,18 +195,24 @@ found:
   p->pgroup_master = (mode & CLONE_THREAD) ? myproc()->pgroup_master : p;
   p->pgid          = p->pgroup_master->pid;
   linked_list_init(&p->pgroup);
-  linked_list_init(&p->stackbin);
+  initstackbin(&p->stackbin);
+  p->stackpages = 0;
+  // affinity는 fork, thread_create 모두 부모의 pgroup에서 상속된다
+  p->affinity = myproc() ? myproc()->pgroup_master->affinity : AFFINITYALL;
+  p->nohelp   = 0;
+  p->execip   = 0;
+  p->nexecseg = 0;
   if (mode & CLONE_THREAD)
   {
     linked_list_push_back(&p->pgroup, &p->pgroup_master->pgroup);
   } 
 
-  // p가 pgroup_master일 경우 mlfq에 p 추가
+  // p가 pgroup_master일 경우 가장 한가한 cpu의 mlfq에 p 추가
   // 최대 process 개수 == mlfq level 0의 크기
-  // 따라서 mlfqpush가 실패하면 logic error
-  if (is_pgroup_master(p) && mlfqpush(p))
+  // 따라서 schedpush가 실패하면 logic error
+  if (is_pgroup_master(p) && schedpush(p))
   {
-    panic("allocproc: mlfqpush failure");
+    panic("allocproc: schedpush failure");
   }
 
   RELEASE;
@@ -239,7 +285,7 @@ userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&ptable.lock);
 }
@@ -255,19 +301,28 @@ growproc(int n)
   sz = pgmaster->sz;
   if (n > 0)
   {
-    if ((sz = allocuvm(pgmaster->pgdir, sz, sz + n)) == 0)
+    // page는 처음 접근할 때 lazyfault()가 할당하므로 크기만 늘린다
+    // 지금 남은 물리 메모리로 감당할 수 없는 요청은 바로 거절한다
+    uint pages = (PGROUNDUP(sz + n) - PGROUNDUP(sz)) / PGSIZE;
+    if (sz + n < sz || sz + n >= KERNBASE || pages > kfreepages())
     {
       release(&pgmaster->pgroup_lock);
       return -1;
     }
+    sz += n;
   }
   else if (n < 0)
   {
-    if ((sz = deallocuvm(pgmaster->pgdir, sz, sz + n)) == 0)
+    if (sz + n > sz)
     {
       release(&pgmaster->pgroup_lock);
       return -1;
     }
+    // 다른 cpu에서 실행 중인 LWP가 줄어든 영역에 새로 fault하지 않도록
+    // sz를 먼저 줄이고, 모든 cpu의 TLB에서 지워진 뒤에 page를 해제한다
+    pgmaster->sz = sz + n;
+    shrinkuvm(pgmaster->pgdir, sz, sz + n);
+    sz += n;
   }
   pgmaster->sz = sz;
 
@@ -311,12 +366,17 @@ clone(struct clone_args args)
     // 단순 값 복사로도 같은 객체를 공유하게 할 수 있음
     np->pgdir = pgmaster->pgdir;
 
+    // sz와 stackbin은 growproc(), thread_join()과 같이 pgroup_lock으로
+    // 보호한다
+    acquire(&pgmaster->pgroup_lock);
+
     // alloc stack
-    np->sz =
-        allocpageuvm(pgmaster->pgdir, &pgmaster->stackbin, pgmaster->sz, 2);
+    np->sz = allocpageuvm(pgmaster->pgdir, &pgmaster->stackbin, pgmaster->sz,
+                          args.stackpages);
     if (!np->sz)
     {
       // ROLLBACK
+      release(&pgmaster->pgroup_lock);
       kfree(np->kstack);
       np->kstack = 0;
       np->state  = UNUSED;
@@ -327,15 +387,17 @@ clone(struct clone_args args)
 
     // | ---------- |  <- np->sz
     // |  new stack |
-    // | ---------- |  <- np->sz - 1 * PGSIZE
+    // | ---------- |  <- np->sz - (stackpages - 1) * PGSIZE
     // |  guard     |
-    // | ---------- |  <- np->sz - 2 * PGSIZE
+    // | ---------- |  <- np->sz - stackpages * PGSIZE
     // |  stack     |
     // | ---------- |
-    clearpteu(pgmaster->pgdir, (char*)(np->sz - 2 * PGSIZE));
+    np->stackpages = args.stackpages;
+    clearpteu(pgmaster->pgdir, (char*)(np->sz - np->stackpages * PGSIZE));
 
     // stack 영역을 공유함
     pgmaster->sz = np->sz > pgmaster->sz ? np->sz : pgmaster->sz;
+    release(&pgmaster->pgroup_lock);
 
     // parent 같음
     np->parent = pgmaster->parent;
@@ -364,8 +426,30 @@ clone(struct clone_args args)
   }
   else
   {
+    // 다른 cpu에서 실행 중인 LWP가 copy-on-write로 바꾸는 중인 page에
+    // 쓰지 못하도록 복사하는 동안 pgroup을 멈춘다
+    int quiesced = !linked_list_is_empty(&pgmaster->pgroup);
+    if (quiesced)
+    {
+      acquire(&ptable.lock);
+      pgroup_quiesce(curproc);
+      release(&ptable.lock);
+    }
+
     // Copy process state from proc.
-    if ((np->pgdir = copyuvm(pgmaster->pgdir, pgmaster->sz)) == 0)
+    acquire(&pgmaster->pgroup_lock);
+    np->sz    = pgmaster->sz;
+    np->pgdir = copyuvm(pgmaster->pgdir, np->sz);
+    release(&pgmaster->pgroup_lock);
+
+    if (quiesced)
+    {
+      acquire(&ptable.lock);
+      pgmaster->nohelp = 0;
+      release(&ptable.lock);
+    }
+
+    if (np->pgdir == 0)
     {
       kfree(np->kstack);
       np->kstack = 0;
@@ -376,7 +460,6 @@ clone(struct clone_args args)
       return -1;
     }
 
-    np->sz     = pgmaster->sz;
     np->parent = pgmaster;
     *np->tf    = *curproc->tf;
 
@@ -384,6 +467,12 @@ clone(struct clone_args args)
       if (pgmaster->ofile[i])
         np->ofile[i] = filedup(pgmaster->ofile[i]);
     np->cwd = idup(pgmaster->cwd);
+
+    // 아직 읽지 않은 실행 파일 page는 자식도 같은 inode에서 읽는다
+    if (pgmaster->execip)
+      np->execip = iexec(idup(pgmaster->execip));
+    memmove(np->execseg, pgmaster->execseg, sizeof(np->execseg));
+    np->nexecseg = pgmaster->nexecseg;
   }
   // Clear %eax so that fork returns 0 in the child.
 
@@ -394,7 +483,7 @@ clone(struct clone_args args)
   pid = np->pid;
   ACQUIRE;
 
-  np->state = RUNNABLE;
+  setrunnable(np);
 
   RELEASE;
 
@@ -414,11 +503,43 @@ fork(void)
   return clone(args);
 }
 
+// curproc을 제외한 pgroup의 LWP가 모두 cpu에서 내려올 때까지 기다린다
+// parallel mode에서만 다른 LWP가 동시에 RUNNING일 수 있다
+// nohelp을 세우면 빌려간 cpu는 다음 timer interrupt에 LWP를 돌려주고,
+// 깨어난 curproc은 원래 cpu에서만 실행되므로 결국 혼자 남게 된다
+// ptable.lock을 잡은 상태에서 호출해야 한다
+static void
+pgroup_quiesce(struct proc* curproc)
+{
+  struct proc* pgmaster = curproc->pgroup_master;
+  pgmaster->nohelp      = 1;
+  for (;;)
+  {
+    int running = pgmaster != curproc && pgmaster->state == RUNNING;
+    for (struct linked_list* pos = pgmaster->pgroup.next;
+         pos != &pgmaster->pgroup && !running; pos = pos->next)
+    {
+      struct proc* p = container_of(pos, struct proc, pgroup);
+      running        = p != curproc && p->state == RUNNING;
+    }
+    if (!running)
+    {
+      return;
+    }
+    sleep(&ticks, &ptable.lock);
+  }
+}
+
 void
 clear_threads_exec(void)
 {
   struct proc* curproc = myproc();
 
+  // 다른 cpu에서 실행 중인 LWP의 kstack을 해제하지 않도록 한다
+  acquire(&ptable.lock);
+  pgroup_quiesce(curproc);
+  release(&ptable.lock);
+
   // 자기자신을 제외한 모든 쓰레드를 exit
   for (struct linked_list *pos = curproc->pgroup.next, *next = pos->next;
       pos != &curproc->pgroup; pos = next, next = pos->next)
@@ -431,8 +552,20 @@ clear_threads_exec(void)
     p->cwd = 0;
   }
 
+  // LWP가 exec한 경우 master가 들고 있던 실행 파일을 넘겨받는다
+  struct proc* pgmaster = curproc->pgroup_master;
+  if (pgmaster != curproc)
+  {
+    curproc->execip = pgmaster->execip;
+    memmove(curproc->execseg, pgmaster->execseg, sizeof(curproc->execseg));
+    curproc->nexecseg = pgmaster->nexecseg;
+    pgmaster->execip  = 0;
+  }
+  freestackbin(&pgmaster->stackbin);
+
   free_threads(curproc);
   curproc->pgroup_master = curproc;
+  curproc->nohelp        = 0;
 }
 
 // Exit the current process.  Does not return.
@@ -447,7 +580,9 @@ exit(void)
   {
     acquire(&ptable.lock);
     set_killed(pgmaster, 1);
-    pgmaster->state = RUNNABLE;
+    // parallel mode에서는 master가 다른 cpu에서 실행 중일 수 있다
+    if (pgmaster->state == SLEEPING)
+      setrunnable(pgmaster);
     curproc->chan  = (void*)-1;
     curproc->state = SLEEPING;
     pgroup_sched();
@@ -473,12 +608,18 @@ exit(void)
 
   begin_op();
   iput(pgmaster->cwd);
+  if (pgmaster->execip)
+    iexecput(pgmaster->execip);
   end_op();
-  pgmaster->cwd = 0;
+  pgmaster->cwd    = 0;
+  pgmaster->execip = 0;
 
   // release - acquire 사이에 다른 스레드가 실행되는 것을 방지
   acquire(&ptable.lock);
 
+  // 다른 cpu에서 실행 중인 LWP가 없어야 pgroup 전체를 ZOMBIE로 만들 수 있다
+  pgroup_quiesce(curproc);
+
   // Parent might be sleeping in wait().
   wakeup1(pgmaster->parent);
 
@@ -563,6 +704,7 @@ wait(void)
 
         // free vm
         freevm(p->pgdir);
+        freestackbin(&p->stackbin);
 
         // free threads
         free_threads(p);
@@ -610,6 +752,8 @@ swtch_pgroup(struct proc* old_lwp, struct proc* new_lwp)
     panic("swtch_pgroup: no kstack");
   }
 
+  traceswitchout(old_lwp);
+  tracedispatch(new_lwp);
   new_lwp->state = RUNNING;
 
   // kstack만 전환하면 됨
@@ -640,7 +784,9 @@ pgroup_sched(void)
   struct proc* pgmaster = curproc->pgroup_master;
   // dump_pgroup(curproc);
   // single thread이거나, time quantum을 넘어 scheduling이 필요할 경우
-  if (linked_list_is_empty(&pgmaster->pgroup) || isexhaustedprocess(pgmaster))
+  // 다른 cpu의 LWP를 빌려 실행 중이라면 항상 scheduler로 돌려준다
+  if (linked_list_is_empty(&pgmaster->pgroup) || mycpu()->helping ||
+      isexhaustedprocess(pgmaster))
   {
     pgmaster->schedule.yield = 1;
     sched();
@@ -674,6 +820,92 @@ pgroup_sched(void)
   swtch_pgroup(curproc, target);
 }
 
+// parallel mode에서 실행할 pgroup이 없는 cpu는 다른 cpu에서 실행 중인
+// pgroup의 runnable한 LWP를 빌려 실행한다. 빌린 LWP는 그 pgroup의 time
+// slice가 끝날 때까지만 실행하고, 사용한 시간은 pgroup에 청구한다
+// ptable.lock을 잡은 상태에서 호출해야 하며, LWP를 실행했다면 1을 반환한다
+static int
+pgroup_help(struct cpu* c, int cpu)
+{
+  struct proc* lwp = 0;
+  if (!schedhelpable(cpu))
+  {
+    return 0;
+  }
+
+  for (struct cpu* home = cpus; home < &cpus[ncpu] && !lwp; ++home)
+  {
+    struct proc* cur = home->proc;
+    if (home == c || !cur || home->helping)
+    {
+      continue;
+    }
+
+    struct proc* master = cur->pgroup_master;
+    if (master->nohelp || master->schedule.cpu != home - cpus ||
+        !(master->affinity & (1 << cpu)))
+    {
+      continue;
+    }
+    lwp = get_runnable(master);
+  }
+
+  if (!lwp)
+  {
+    return 0;
+  }
+
+  struct proc* master = lwp->pgroup_master;
+  uint64 now          = clockus();
+  int left =
+      master->schedule.lastscheduledus + schedslice(master) - (uint)now;
+  if (left <= TIMERSLACKUS)
+  {
+    return 0;
+  }
+
+  c->helping = 1;
+  c->proc    = lwp;
+  switchuvm(lwp);
+  lwp->state = RUNNING;
+  tracedispatch(lwp);
+  lapicdeadline(now + left);
+  swtch(&(c->scheduler), lwp->context);
+  uint end = clockus();
+  lapicdeadline(0);
+  switchkvm();
+  traceswitchout(c->proc);
+  c->proc    = 0;
+  c->helping = 0;
+
+  schedcharge(master, end - (uint)now);
+  return 1;
+}
+
+// 실행할 process가 없을 때 다음 interrupt (timer 또는 wakeup IPI)까지
+// cpu를 멈춘다. wakeup 쪽은 process를 RUNNABLE로 만든 뒤 rq->lock을 거쳐
+// idle을 확인하므로, idle을 세운 뒤 run queue를 다시 확인하면 IPI를
+// 놓치지 않는다
+static void
+schedidle(struct cpu* c, int cpu)
+{
+  // 할 일이 없으면 kalloc_zeroed()에 쓸 page를 미리 지워둔다
+  // 한 번에 한 page씩만 지우고 돌아가 run queue를 다시 확인한다
+  if (kzeroidle())
+  {
+    return;
+  }
+
+  cli();
+  c->idle = 1;
+  if (!schedhasrunnable(cpu))
+  {
+    stihlt();
+  }
+  c->idle = 0;
+  sti();
+}
+
 // PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -682,65 +914,74 @@ pgroup_sched(void)
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
-struct proc* get_runnable(struct proc*);
-extern struct stridescheduler mainstride;
-extern struct stridescheduler masterscheduler;
 void
 scheduler(void)
 {
   struct proc* p = 0;
   struct cpu* c  = mycpu();
+  int cpu        = c - cpus;
   c->proc        = 0;
   int expired    = 1;
-  int schedidx   = 0;
-
-  strideinit(&masterscheduler, 100);
-  stridepush(&masterscheduler, (void*)SCHEDMLFQ, 100);
-
-  strideinit(&mainstride, 80);
 
   for (;;)
   {
     // Enable interrupts on this processor.
     sti();
-    // Loop over process table looking for process to run.
-    acquire(&ptable.lock);
-
-    schedidx = (int)stridetop(&masterscheduler);
 
     if (!p && !expired)
     {
       panic("invalid p expired");
     }
-    // expired가 true일 때 스케줄러에서 p을 받아옴
-    if (!p || expired || p->state != RUNNABLE || p->schedule.sched != schedidx)
+
+    // 자신의 run queue에서 실행할 process를 고른다
+    // run queue는 cpu마다 lock이 따로 있으므로 ptable.lock이 필요 없다
+    p = schedpick(&runqueues[cpu], p, expired);
+
+    // 실행할 process가 없고 다른 cpu에도 process가 없다면
+    // ptable.lock을 잡지 않는다
+    if (!p && !schedstealable(cpu) && !schedhelpable(cpu) &&
+        ticks < runqueues[cpu].nextbalancetick)
     {
-      // update schedidx
-      switch (schedidx)
-      {
-      case SCHEDMLFQ: // mlfq
-        p = mlfqtop();
-        if (p)
-        {
-          break;
-        }
-      case SCHEDSTRIDE: // stride
-        p = stridetop(&mainstride);
-        if (p)
-        {
-          schedidx = 1;
-          break;
-        }
-      default:
-        break;
-        // no process
-      }
+      expired = 1;
+      schedidle(c, cpu);
+      continue;
     }
+
+    acquire(&ptable.lock);
+
+    if (ticks >= runqueues[cpu].nextbalancetick)
+    {
+      schedbalance(cpu);
+    }
+
+    // run queue가 비었으면 다른 cpu의 process를 가져온다
+    if (!p)
+    {
+      p = schedsteal(cpu);
+    }
+
+    // ptable.lock 없이 고른 process이므로 그 사이에 다른 cpu로 옮겨졌거나
+    // 종료되었을 수 있다
+    if (p && (!is_pgroup_master(p) || p->schedule.cpu != cpu))
+    {
+      p = 0;
+    }
+
+    // 실행 중에 affinity가 바뀌어 옮기지 못한 pgroup
+    if (p && !(p->affinity & (1 << cpu)))
+    {
+      schedmigrate(p);
+      p = 0;
+    }
+
+    expired = 1;
+
     // Switch to chosen process.  It is the process's job
     // to release ptable.lock and then reacquire it
     // before jumping back to us.
     if (p)
     {
+      uint64 now = 0;
       uint start = 0;
       uint end   = 0;
 
@@ -750,33 +991,39 @@ scheduler(void)
         p->pgroup_current_execute = rp;
         c->proc                   = rp;
         switchuvm(rp);
-        rp->state                     = RUNNING;
-        start                         = sys_uptime();
-        p->schedule.lastscheduledtick = start;
+        rp->state                   = RUNNING;
+        now                         = clockus();
+        start                       = now;
+        p->schedule.lastscheduledus = start;
+        // time slice가 끝나는 순간에 timer interrupt가 발생하도록 한다
+        lapicdeadline(now + schedslice(p));
+        tracedispatch(rp);
         swtch(&(c->scheduler), rp->context);
-        end = sys_uptime();
+        end = clockus();
+        lapicdeadline(0);
         switchkvm();
+        traceswitchout(c->proc);
       }
 
-      switch (p->schedule.sched)
-      {
-      case SCHEDMLFQ:
-        expired = mlfqnext(p, start, end);
-        break;
+      expired = schednext(p, start, end);
 
-      case SCHEDSTRIDE:
-        expired = 1;
-        break;
-
-      default:
-        panic("scheduler: invalid schedidx");
-      }
       // Process is done running for now.
       // It should have changed its p->state before coming back.
       c->proc = 0;
     }
+    else if (pgroup_help(c, cpu))
+    {
+      release(&ptable.lock);
+      continue;
+    }
 
     release(&ptable.lock);
+
+    // steal도 실패했다면 다음 interrupt까지 쉰다
+    if (!p)
+    {
+      schedidle(c, cpu);
+    }
   }
 }
 
@@ -865,6 +1112,7 @@ sleep(void* chan, struct spinlock* lk)
   // Go to sleep.
   p->chan  = chan;
   p->state = SLEEPING;
+  schedtrace(TRACE_SLEEP, p, 0);
 
   pgroup_sched();
 
@@ -889,7 +1137,7 @@ wakeup1(void* chan)
 
   for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
     if (p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+      setrunnable(p);
 }
 
 // Wake up all processes sleeping on chan.
@@ -917,7 +1165,7 @@ kill(int pid)
       set_killed(p, 1);
       // Wake process from sleep if necessary.
       if (p->state == SLEEPING)
-        p->state = RUNNABLE;
+        setrunnable(p);
       release(&ptable.lock);
       return 0;
     }
@@ -926,6 +1174,48 @@ kill(int pid)
   return -1;
 }
 
+// pid의 pgroup을 mask의 cpu에서만 실행되도록 한다
+// pid가 0이면 호출한 process
+int
+setaffinity(int pid, uint mask)
+{
+  struct proc* p;
+  int result = -1;
+
+  acquire(&ptable.lock);
+  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  {
+    if (p->state != UNUSED && p->pid == (pid ? pid : myproc()->pid))
+    {
+      result = schedsetaffinity(p, mask);
+      break;
+    }
+  }
+  release(&ptable.lock);
+  return result;
+}
+
+// pid의 pgroup이 실행될 수 있는 cpu의 bitmask
+// pid가 0이면 호출한 process
+int
+getaffinity(int pid)
+{
+  struct proc* p;
+  int result = -1;
+
+  acquire(&ptable.lock);
+  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  {
+    if (p->state != UNUSED && p->pid == (pid ? pid : myproc()->pid))
+    {
+      result = p->pgroup_master->affinity & ((1 << ncpu) - 1);
+      break;
+    }
+  }
+  release(&ptable.lock);
+  return result;
+}
+
 // PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -961,13 +1251,22 @@ procdump(void)
   }
 }
 
+// stacksize byte의 stack을 가진 thread를 만든다. 0이면 THREADSTACK page
 int
-thread_create(thread_t* thread, void* (*start_routine)(void*), void* arg)
+thread_create(thread_t* thread, void* (*start_routine)(void*), void* arg,
+              uint stacksize)
 {
+  if (stacksize >= KERNBASE)
+  {
+    return -1;
+  }
+  uint stackpages = stacksize ? PGROUNDUP(stacksize) / PGSIZE : THREADSTACK;
+
   struct clone_args args = { .mode          = CLONE_THREAD,
                              .args          = arg,
                              .start_routine = start_routine,
-                             .lock          = &ptable.lock };
+                             .lock          = &ptable.lock,
+                             .stackpages    = stackpages + 1 };
   // ptable.lock을 전역으로 잡을 필요가 없음 (놀랍게도)
   // acquire(&ptable.lock);
   int lwpid = clone(args);
@@ -1057,8 +1356,12 @@ found:
         panic("remove./..");
       }
 
-      setpteu(pgmaster->pgdir, (char*)(p->sz - 2 * PGSIZE));
-      freepageuvm(pgmaster->pgdir, &pgmaster->stackbin, p->sz, 2);
+      // stack의 page를 해제하고 stackbin에 돌려준다
+      // 맨 위의 stack이었다면 sz가 줄어든다
+      acquire(&pgmaster->pgroup_lock);
+      pgmaster->sz = freepageuvm(pgmaster->pgdir, &pgmaster->stackbin,
+                                 pgmaster->sz, p->sz, p->stackpages);
+      release(&pgmaster->pgroup_lock);
 
       *retval = p->retval;
       kfree(p->kstack);
@@ -1108,8 +1411,12 @@ ps()
     }
   }
 
-  mlfqprint();
-  strideprint(&mainstride);
+  for (int i = 0; i < ncpu; ++i)
+  {
+    cprintf("[cpu%d] nproc: %d\n", i, runqueues[i].nproc);
+    mlfqprint(&runqueues[i]);
+    strideprint(&runqueues[i].mainstride);
+  }
 
   return 0;
 }
\ No newline at end of file
@@ -16,6 +16,10 @@ struct cpu
   int ncli;                  // Depth of pushcli nesting.
   int intena;                // Were interrupts enabled before pushcli?
   struct proc* proc;         // The process running on this cpu or null
+  volatile int idle;         // Halted in scheduler() waiting for work?
+  int helping;               // Running an LWP of another cpu's pgroup?
+  volatile uint tlbreq;      // TLB flushes other cpus asked for
+  volatile uint tlbdone;     // tlbreq as of the last flush done
 };
 
 extern struct cpu cpus[NCPU];
@@ -57,6 +61,22 @@ enum schedulerenum
   SCHEDSTRIDE
 };
 
+// exec()으로 읽은 ELF segment. page는 처음 접근할 때 실행 파일에서 읽는다
+struct execseg
+{
+  uint vaddr;
+  uint memsz;
+  uint off;
+  uint filesz;
+};
+
+// thread stack으로 쓰다 반납된 주소 범위들 (vm.c의 struct stackrange)
+struct stackbin
+{
+  struct linked_list byaddr;              // 주소 순서, 이웃한 범위를 합칠 때 사용
+  struct linked_list bysize[NSTACKCLASS]; // 크기 class별
+};
+
 enum CLONEMODE
 {
   CLONE_NONE = 1,
@@ -82,19 +102,29 @@ struct proc
 
   int pgid;
   struct linked_list pgroup;  // pgroup에 속한 proc들의 linked list
-  struct linked_list stackbin;// pgroup에 속한 proc들의 stack을 위한 bin
+  struct stackbin stackbin;   // pgroup에 속한 proc들의 stack을 위한 bin
+  uint stackpages;            // guard page를 포함한 thread stack의 크기 (LWP)
   struct proc* pgroup_master;
   struct proc* pgroup_current_execute;
-  struct spinlock pgroup_lock;
+  struct spinlock pgroup_lock; // pgroup_master의 sz와 stackbin을 보호한다
   void* retval;
 
+  struct linked_list schednode; // run queue에서의 위치
+  uint affinity; // 실행할 수 있는 cpu의 bitmask, pgroup 전체가 같은 값을 가짐
+  int nohelp;    // 1이면 다른 cpu가 이 pgroup의 LWP를 빌려가지 않음 (master)
+  struct inode* execip;             // demand paging 중인 실행 파일 (master)
+  struct execseg execseg[NEXECSEG]; // 아직 읽지 않은 page가 있을 수 있는 segment
+  int nexecseg;
   struct
   {
-    uint lastscheduledtick;
-    uint executionticks;
+    uint lastscheduledus; // 마지막으로 dispatch된 clockus()
+    uint executionus;     // 현재 level에서 사용한 시간 (us)
     int level;
     int yield;
     enum schedulerenum sched;
+    int ticket; // set_cpu_share로 요청한 ticket (SCHEDSTRIDE)
+    int cpu;    // 배정된 run queue의 cpu index
+    int parked; // runqueue.parked에 있는지 여부
   } schedule;
 };
 
@@ -104,7 +134,8 @@ struct proc
 //   fixed-size stack
 //   expandable heap
 
-int thread_create(thread_t* thread, void* (*start_routine)(void*), void* arg);
+int thread_create(thread_t* thread, void* (*start_routine)(void*), void* arg,
+                  uint stacksize);
 void thread_exit(void* retval);
 int thread_join(thread_t thread, void** retval);
 void pgroup_sched(void);
@@ -0,0 +1,441 @@
+// Scheduler benchmark.
+// Runs each workload pinned to cpu 0, collects scheduler events with
+// sched_trace() and reports one line per metric:
+//   <metric> n <count> p50 <us> p90 <us> p99 <us> max <us> <PASS|FAIL>
+//   <metric> target <pct> achieved <pct> <PASS|FAIL>
+// The last line is "result PASS" or "result FAIL".
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "schedparam.h"
+#include "schedtrace.h"
+
+#define BENCHCPU      0
+#define PINGPONGROUND 64
+#define SHARETICKS    200 // ticks
+#define STARVETICKS   300 // ticks
+#define NSPIN         3
+
+// The process blocking in read() has already made the other one
+// RUNNABLE, so a switch between them is one pass of the scheduler
+// loop and never waits for the timer. Allow a fifth of a tick.
+#define CTXSWITCH_P99_US (TICKUS / 5)
+// A stride share is off by at most one STRIDEQUANTUM (5 ticks) at
+// either end of the SHARETICKS window: two quanta, in percent.
+#define SHARE_TOLERANCE  (2 * 5 * 100 / SHARETICKS)
+
+struct traceevent* events;
+int nevents;
+int dropped;
+uint seq[NCPU];
+int ncpu;
+int failed;
+
+// Start collecting events on every cpu.
+void
+tracebegin(void)
+{
+  for (ncpu = 0; ncpu < NCPU; ++ncpu)
+  {
+    seq[ncpu] = TRACE_NOW;
+    if (sched_trace(ncpu, &seq[ncpu], 0, 0) < 0)
+    {
+      break;
+    }
+  }
+}
+
+// Read the events of every cpu since tracebegin() and merge them into
+// events[] in time order. Times are rebased to the first event.
+void
+traceend(void)
+{
+  struct traceevent* percpu[NCPU];
+  int count[NCPU];
+  int pos[NCPU];
+
+  dropped = 0;
+  for (int cpu = 0; cpu < ncpu; ++cpu)
+  {
+    uint start  = seq[cpu];
+    percpu[cpu] = malloc(NTRACE * sizeof(struct traceevent));
+    count[cpu]  = 0;
+    pos[cpu]    = 0;
+    int n;
+    while (count[cpu] < NTRACE &&
+           (n = sched_trace(cpu, &seq[cpu], percpu[cpu] + count[cpu],
+                            NTRACE - count[cpu])) > 0)
+    {
+      count[cpu] += n;
+    }
+    dropped += seq[cpu] - start - count[cpu];
+  }
+
+  nevents = 0;
+  for (;;)
+  {
+    int next = -1;
+    for (int cpu = 0; cpu < ncpu; ++cpu)
+    {
+      if (pos[cpu] < count[cpu] &&
+          (next < 0 ||
+           percpu[cpu][pos[cpu]].time < percpu[next][pos[next]].time))
+      {
+        next = cpu;
+      }
+    }
+    if (next < 0)
+    {
+      break;
+    }
+    events[nevents++] = percpu[next][pos[next]++];
+  }
+
+  for (int i = nevents - 1; i >= 0; --i)
+  {
+    events[i].time -= events[0].time;
+  }
+  for (int cpu = 0; cpu < ncpu; ++cpu)
+  {
+    free(percpu[cpu]);
+  }
+}
+
+void
+sort(uint* a, int n)
+{
+  for (int i = 1; i < n; ++i)
+  {
+    uint v = a[i];
+    int j  = i - 1;
+    for (; j >= 0 && a[j] > v; --j)
+    {
+      a[j + 1] = a[j];
+    }
+    a[j + 1] = v;
+  }
+}
+
+// Print percentiles of samples and check max percentile against limit.
+void
+report(char* metric, uint* samples, int n, uint limit)
+{
+  sort(samples, n);
+  uint p50 = n ? samples[n * 50 / 100] : 0;
+  uint p90 = n ? samples[n * 90 / 100] : 0;
+  uint p99 = n ? samples[n * 99 / 100] : 0;
+  uint max = n ? samples[n - 1] : 0;
+  int pass = n > 0 && p99 <= limit;
+
+  printf(1, "%s n %d p50 %d p90 %d p99 %d max %d %s\n", metric, n, p50, p90,
+         p99, max, pass ? "PASS" : "FAIL");
+  failed |= !pass;
+}
+
+void
+pin(void)
+{
+  if (sched_setaffinity(0, 1 << BENCHCPU) < 0)
+  {
+    printf(1, "FAIL : sched_setaffinity\n");
+    exit();
+  }
+}
+
+void
+spin(int until)
+{
+  while (uptime() < until)
+    ;
+}
+
+int
+istarget(int pid, int* pids, int n)
+{
+  for (int i = 0; i < n; ++i)
+  {
+    if (pids[i] == pid)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Two processes on the same cpu bounce a byte through a pair of pipes.
+// Context switch: one of them stops and the other is dispatched next
+// on that cpu. Wakeup: a process becomes RUNNABLE until dispatched.
+void
+bench_pingpong(void)
+{
+  int ping[2], pong[2];
+  int pids[2];
+  char c = 0;
+
+  if (pipe(ping) < 0 || pipe(pong) < 0)
+  {
+    printf(1, "FAIL : pipe\n");
+    exit();
+  }
+
+  tracebegin();
+  for (int i = 0; i < 2; ++i)
+  {
+    if ((pids[i] = fork()) == 0)
+    {
+      pin();
+      for (int round = 0; round < PINGPONGROUND; ++round)
+      {
+        if (i == 0)
+        {
+          write(ping[1], &c, 1);
+          read(pong[0], &c, 1);
+        }
+        else
+        {
+          read(ping[0], &c, 1);
+          write(pong[1], &c, 1);
+        }
+      }
+      exit();
+    }
+  }
+  wait();
+  wait();
+  traceend();
+
+  uint* ctx  = malloc(nevents * sizeof(uint));
+  uint* wake = malloc(nevents * sizeof(uint));
+  int nctx   = 0;
+  int nwake  = 0;
+  uint stop  = 0;
+  int stopped = 0;
+  struct schedparam param;
+
+  for (int i = 0; i < nevents; ++i)
+  {
+    struct traceevent* e = &events[i];
+    if (!istarget(e->pid, pids, 2))
+    {
+      continue;
+    }
+
+    if (e->cpu == BENCHCPU &&
+        (e->type == TRACE_SLEEP || e->type == TRACE_PREEMPT))
+    {
+      stop    = e->time;
+      stopped = e->pid;
+    }
+    else if (e->cpu == BENCHCPU && e->type == TRACE_DISPATCH)
+    {
+      if (stopped && stopped != e->pid)
+      {
+        ctx[nctx++] = e->time - stop;
+      }
+      stopped = 0;
+    }
+
+    if (e->type == TRACE_WAKEUP)
+    {
+      for (int j = i + 1; j < nevents; ++j)
+      {
+        if (events[j].pid == e->pid && events[j].type == TRACE_DISPATCH)
+        {
+          wake[nwake++] = events[j].time - e->time;
+          break;
+        }
+      }
+    }
+  }
+
+  report("ctxswitch_us", ctx, nctx, CTXSWITCH_P99_US);
+  // A woken process waits at most for the other one to block,
+  // which it does within its top level quantum.
+  sched_getparam(&param);
+  report("wakeup_us", wake, nwake, param.quantum[0]);
+  free(ctx);
+  free(wake);
+  close(ping[0]);
+  close(ping[1]);
+  close(pong[0]);
+  close(pong[1]);
+}
+
+// Run time of pid between dispatch and the next stop on the same cpu.
+uint
+runtime(int pid)
+{
+  uint total = 0;
+  uint start = 0;
+  int run    = 0;
+
+  for (int i = 0; i < nevents; ++i)
+  {
+    struct traceevent* e = &events[i];
+    if (e->cpu != BENCHCPU)
+    {
+      continue;
+    }
+    if (run && e->type != TRACE_WAKEUP && e->type != TRACE_BOOST &&
+        e->type != TRACE_DEMOTE)
+    {
+      total += e->time - start;
+      run = 0;
+    }
+    if (e->type == TRACE_DISPATCH && e->pid == pid)
+    {
+      start = e->time;
+      run   = 1;
+    }
+  }
+  return total;
+}
+
+// Two stride processes and one MLFQ process compete for one cpu.
+void
+bench_share(void)
+{
+  int share[2] = { 10, 30 };
+  int pids[3];
+  int until = uptime() + SHARETICKS;
+
+  tracebegin();
+  for (int i = 0; i < 3; ++i)
+  {
+    if ((pids[i] = fork()) == 0)
+    {
+      pin();
+      if (i < 2 && set_cpu_share(share[i]) != 0)
+      {
+        printf(1, "FAIL : set_cpu_share\n");
+        exit();
+      }
+      spin(until);
+      exit();
+    }
+  }
+  for (int i = 0; i < 3; ++i)
+  {
+    wait();
+  }
+  traceend();
+
+  uint window = nevents ? events[nevents - 1].time : 0;
+  for (int i = 0; i < 2; ++i)
+  {
+    uint achieved = window ? runtime(pids[i]) / (window / 100 + 1) : 0;
+    int diff      = achieved - share[i];
+    int pass      = diff <= SHARE_TOLERANCE && diff >= -SHARE_TOLERANCE;
+    printf(1, "stride_share target %d achieved %d %s\n", share[i], achieved,
+           pass ? "PASS" : "FAIL");
+    failed |= !pass;
+  }
+}
+
+// CPU bound MLFQ processes sink to the lowest level and rely on the
+// priority boost. Starvation: longest time a process stays RUNNABLE
+// without being dispatched. Boost: time from a boost until every
+// spinner has run again.
+void
+bench_starvation(void)
+{
+  struct schedparam param;
+  int pids[NSPIN];
+  int until = uptime() + STARVETICKS;
+
+  sched_getparam(&param);
+
+  tracebegin();
+  for (int i = 0; i < NSPIN; ++i)
+  {
+    if ((pids[i] = fork()) == 0)
+    {
+      pin();
+      spin(until);
+      exit();
+    }
+  }
+  for (int i = 0; i < NSPIN; ++i)
+  {
+    wait();
+  }
+  traceend();
+
+  uint* starve = malloc(nevents * sizeof(uint));
+  uint* boost  = malloc(nevents * sizeof(uint));
+  int nstarve  = 0;
+  int nboost   = 0;
+  uint ready[NSPIN];
+  memset(ready, 0, sizeof(ready));
+
+  for (int i = 0; i < nevents; ++i)
+  {
+    struct traceevent* e = &events[i];
+    for (int j = 0; j < NSPIN; ++j)
+    {
+      if (e->pid != pids[j])
+      {
+        continue;
+      }
+      if (e->type == TRACE_PREEMPT || e->type == TRACE_WAKEUP)
+      {
+        ready[j] = e->time + 1;
+      }
+      else if (e->type == TRACE_DISPATCH && ready[j])
+      {
+        starve[nstarve++] = e->time + 1 - ready[j];
+        ready[j]          = 0;
+      }
+    }
+
+    if (e->type == TRACE_BOOST && e->cpu == BENCHCPU)
+    {
+      int seen = 0;
+      for (int j = i + 1; j < nevents && seen != (1 << NSPIN) - 1; ++j)
+      {
+        if (events[j].type != TRACE_DISPATCH)
+        {
+          continue;
+        }
+        for (int k = 0; k < NSPIN; ++k)
+        {
+          if (events[j].pid == pids[k])
+          {
+            seen |= 1 << k;
+          }
+        }
+        if (seen == (1 << NSPIN) - 1)
+        {
+          boost[nboost++] = events[j].time - e->time;
+        }
+      }
+    }
+  }
+
+  // A spinner at the lowest level waits at most until the next boost
+  // and one more lowest level quantum. After a boost every spinner
+  // runs within one top level quantum of each of the others.
+  report("starvation_us", starve, nstarve,
+         param.boostingperiod * TICKUS + param.quantum[NLEVEL - 1]);
+  report("boost_us", boost, nboost, NSPIN * param.quantum[0] + TICKUS);
+  free(starve);
+  free(boost);
+}
+
+int
+main(int argc, char* argv[])
+{
+  events = malloc(NCPU * NTRACE * sizeof(struct traceevent));
+
+  bench_pingpong();
+  printf(1, "dropped %d\n", dropped);
+  bench_share();
+  printf(1, "dropped %d\n", dropped);
+  bench_starvation();
+  printf(1, "dropped %d\n", dropped);
+
+  printf(1, "result %s\n", failed ? "FAIL" : "PASS");
+  exit();
+}
@@ -0,0 +1,114 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "schedparam.h"
+
+void
+usage(void)
+{
+  printf(2, "usage: schedctl\n");
+  printf(2, "       schedctl quantum <level> <us>\n");
+  printf(2, "       schedctl allotment <level> <us>\n");
+  printf(2, "       schedctl boost <ticks>\n");
+  printf(2, "       schedctl stride <us>\n");
+  printf(2, "       schedctl minticket <ticket>\n");
+  printf(2, "       schedctl parallel <0|1>\n");
+  exit();
+}
+
+void
+print(struct schedparam* param)
+{
+  for (int level = 0; level < NLEVEL; ++level)
+  {
+    printf(1, "level %d: quantum %d us", level, param->quantum[level]);
+    if (level < NLEVEL - 1)
+    {
+      printf(1, ", allotment %d us", param->allotment[level]);
+    }
+    printf(1, "\n");
+  }
+  printf(1, "boost: %d ticks\n", param->boostingperiod);
+  printf(1, "stride quantum: %d us\n", param->stridequantum);
+  printf(1, "mlfq min ticket: %d\n", param->minticket);
+  printf(1, "parallel lwp: %s\n", param->parallel ? "on" : "off");
+}
+
+int
+main(int argc, char* argv[])
+{
+  struct schedparam param;
+
+  if (sched_getparam(&param) < 0)
+  {
+    printf(2, "schedctl: sched_getparam failed\n");
+    exit();
+  }
+
+  if (argc == 1)
+  {
+    print(&param);
+    exit();
+  }
+
+  if (!strcmp(argv[1], "quantum") || !strcmp(argv[1], "allotment"))
+  {
+    if (argc != 4)
+    {
+      usage();
+    }
+    int level = atoi(argv[2]);
+    int limit = !strcmp(argv[1], "quantum") ? NLEVEL : NLEVEL - 1;
+    if (level < 0 || level >= limit)
+    {
+      usage();
+    }
+    if (!strcmp(argv[1], "quantum"))
+    {
+      param.quantum[level] = atoi(argv[3]);
+    }
+    else
+    {
+      param.allotment[level] = atoi(argv[3]);
+    }
+  }
+  else if (argc != 3)
+  {
+    usage();
+  }
+  else if (!strcmp(argv[1], "boost"))
+  {
+    param.boostingperiod = atoi(argv[2]);
+  }
+  else if (!strcmp(argv[1], "stride"))
+  {
+    param.stridequantum = atoi(argv[2]);
+  }
+  else if (!strcmp(argv[1], "minticket"))
+  {
+    param.minticket = atoi(argv[2]);
+  }
+  else if (!strcmp(argv[1], "parallel"))
+  {
+    param.parallel = atoi(argv[2]);
+  }
+  else
+  {
+    usage();
+  }
+
+  int result = sched_setparam(&param);
+  if (result == -2)
+  {
+    printf(2, "schedctl: stride processes hold too many tickets\n");
+    exit();
+  }
+  if (result < 0)
+  {
+    printf(2, "schedctl: invalid parameter\n");
+    exit();
+  }
+  print(&param);
+  exit();
+}
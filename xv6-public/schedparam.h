@@ -0,0 +1,11 @@
+// sched_getparam/sched_setparam으로 주고받는 scheduler 설정
+// 시간 단위는 us, boostingperiod만 tick 단위이다
+struct schedparam
+{
+  int quantum[NLEVEL];       // level별 time quantum (us)
+  int allotment[NLEVEL - 1]; // level별 time allotment (us)
+  int boostingperiod;        // priority boost 주기 (ticks)
+  int stridequantum;         // stride process의 time quantum (us)
+  int minticket;             // MLFQ가 보장받는 최소 ticket
+  int parallel;              // 1이면 idle cpu가 다른 cpu의 LWP를 나눠 실행
+};
@@ -0,0 +1,279 @@
+// scheduler event를 일정 시간 동안 모아 요약한다
+//   schedtrace [-v] [ticks]
+// -v를 주면 모은 event를 시간 순서대로 모두 출력한다
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "schedtrace.h"
+
+#define MAXPID 128
+
+struct pidstat
+{
+  int pid;
+  int ticket;   // stride ticket, mlfq이면 0
+  int ready;    // RUNNABLE이 된 뒤 아직 dispatch되지 않았다면 1
+  uint readyat; // RUNNABLE이 된 시각
+  uint runtime;
+};
+
+struct
+{
+  int pid;
+  int level;
+  uint start;
+} running[NCPU];
+
+struct pidstat pids[MAXPID];
+int npid;
+
+struct traceevent* events[NCPU];
+int nevents[NCPU];
+int ncpu;
+
+uint levelus[NLEVEL + 1]; // [NLEVEL]: stride
+uint waitcount;
+uint waitsum;
+uint waitmax;
+uint demotions;
+uint boosts;
+
+char* names[] = { "dispatch", "preempt", "demote", "boost",
+                  "sleep",    "wakeup",  "exit" };
+
+struct pidstat*
+lookup(int pid)
+{
+  for (int i = 0; i < npid; ++i)
+  {
+    if (pids[i].pid == pid)
+    {
+      return &pids[i];
+    }
+  }
+  if (npid == MAXPID)
+  {
+    return 0;
+  }
+  memset(&pids[npid], 0, sizeof(pids[npid]));
+  pids[npid].pid = pid;
+  return &pids[npid++];
+}
+
+// cpu에서 실행 중이던 pid의 실행 시간을 now까지로 마감한다
+void
+stoprunning(int cpu, uint now)
+{
+  if (!running[cpu].pid)
+  {
+    return;
+  }
+
+  uint runtime = now - running[cpu].start;
+  int level    = running[cpu].level;
+  levelus[(level < 0) ? NLEVEL : level] += runtime;
+
+  struct pidstat* ps = lookup(running[cpu].pid);
+  if (ps)
+  {
+    ps->runtime += runtime;
+  }
+  running[cpu].pid = 0;
+}
+
+void
+account(struct traceevent* e, uint now)
+{
+  struct pidstat* ps = e->pid ? lookup(e->pid) : 0;
+
+  switch (e->type)
+  {
+  case TRACE_DISPATCH:
+    stoprunning(e->cpu, now);
+    running[e->cpu].pid   = e->pid;
+    running[e->cpu].level = e->level;
+    running[e->cpu].start = now;
+    if (ps && ps->ready)
+    {
+      uint wait = now - ps->readyat;
+      ++waitcount;
+      waitsum += wait;
+      waitmax = (wait > waitmax) ? wait : waitmax;
+      ps->ready = 0;
+    }
+    if (ps)
+    {
+      ps->ticket = e->arg;
+    }
+    break;
+
+  case TRACE_PREEMPT:
+  case TRACE_WAKEUP:
+    if (e->type == TRACE_PREEMPT && running[e->cpu].pid == e->pid)
+    {
+      stoprunning(e->cpu, now);
+    }
+    if (ps && !ps->ready)
+    {
+      ps->ready   = 1;
+      ps->readyat = now;
+    }
+    break;
+
+  case TRACE_SLEEP:
+  case TRACE_EXIT:
+    if (running[e->cpu].pid == e->pid)
+    {
+      stoprunning(e->cpu, now);
+    }
+    if (ps)
+    {
+      ps->ready = 0;
+    }
+    break;
+
+  case TRACE_DEMOTE:
+    ++demotions;
+    break;
+
+  case TRACE_BOOST:
+    ++boosts;
+    break;
+  }
+}
+
+// part / whole을 백분율로
+uint
+percent(uint part, uint whole)
+{
+  if (whole >= 100)
+  {
+    return part / (whole / 100);
+  }
+  return whole ? part * 100 / whole : 0;
+}
+
+int
+main(int argc, char* argv[])
+{
+  int verbose = 0;
+  int duration = 100;
+  uint seq[NCPU];
+  int dropped = 0;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "-v"))
+    {
+      verbose = 1;
+    }
+    else
+    {
+      duration = atoi(argv[i]);
+    }
+  }
+
+  // 지금부터의 event만 모은다
+  for (ncpu = 0; ncpu < NCPU; ++ncpu)
+  {
+    seq[ncpu] = TRACE_NOW;
+    if (sched_trace(ncpu, &seq[ncpu], 0, 0) < 0)
+    {
+      break;
+    }
+  }
+
+  sleep(duration);
+
+  for (int cpu = 0; cpu < ncpu; ++cpu)
+  {
+    uint start  = seq[cpu];
+    events[cpu] = malloc(NTRACE * sizeof(struct traceevent));
+    int n;
+    while (nevents[cpu] < NTRACE &&
+           (n = sched_trace(cpu, &seq[cpu], events[cpu] + nevents[cpu],
+                            NTRACE - nevents[cpu])) > 0)
+    {
+      nevents[cpu] += n;
+    }
+    dropped += seq[cpu] - start - nevents[cpu];
+  }
+
+  // cpu별로는 시간 순서이므로 병합하면서 계산한다
+  uint64 base = 0;
+  int first   = 1;
+  uint last   = 0;
+  int total   = 0;
+  int pos[NCPU];
+  memset(pos, 0, sizeof(pos));
+  for (;;)
+  {
+    int next = -1;
+    for (int cpu = 0; cpu < ncpu; ++cpu)
+    {
+      if (pos[cpu] < nevents[cpu] &&
+          (next < 0 ||
+           events[cpu][pos[cpu]].time < events[next][pos[next]].time))
+      {
+        next = cpu;
+      }
+    }
+    if (next < 0)
+    {
+      break;
+    }
+
+    struct traceevent* e = &events[next][pos[next]++];
+    if (first)
+    {
+      base  = e->time;
+      first = 0;
+    }
+    last = e->time - base;
+    ++total;
+
+    if (verbose)
+    {
+      printf(1, "%d cpu%d %s pid %d level %d arg %d\n", last, e->cpu,
+             names[e->type], e->pid, e->level, e->arg);
+    }
+    account(e, last);
+  }
+
+  for (int cpu = 0; cpu < ncpu; ++cpu)
+  {
+    stoprunning(cpu, last);
+  }
+
+  uint busy = 0;
+  for (int level = 0; level <= NLEVEL; ++level)
+  {
+    busy += levelus[level];
+  }
+
+  printf(1, "window_us %d cpus %d events %d dropped %d\n", last, ncpu, total,
+         dropped);
+  printf(1, "wait count %d avg_us %d max_us %d\n", waitcount,
+         waitcount ? waitsum / waitcount : 0, waitmax);
+  for (int level = 0; level < NLEVEL; ++level)
+  {
+    printf(1, "level %d run_us %d pct %d\n", level, levelus[level],
+           percent(levelus[level], busy));
+  }
+  printf(1, "stride run_us %d pct %d\n", levelus[NLEVEL],
+         percent(levelus[NLEVEL], busy));
+  printf(1, "demotions %d boosts %d\n", demotions, boosts);
+
+  // stride share는 한 cpu에 대한 비율이다
+  for (int i = 0; i < npid; ++i)
+  {
+    if (pids[i].ticket)
+    {
+      printf(1, "stride pid %d requested_pct %d achieved_pct %d\n", pids[i].pid,
+             pids[i].ticket, percent(pids[i].runtime, last));
+    }
+  }
+  exit();
+}
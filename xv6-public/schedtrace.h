@@ -0,0 +1,22 @@
+// sched_trace로 읽는 scheduler event
+// 각 cpu는 최근 NTRACE개의 event를 ring buffer에 기록한다
+#define NTRACE    1024
+#define TRACE_NOW 0xFFFFFFFF // sched_trace의 seq로 넘기면 현재 위치를 돌려받음
+
+#define TRACE_DISPATCH 0 // pid가 cpu에서 실행되기 시작함 (arg: stride ticket)
+#define TRACE_PREEMPT  1 // pid가 RUNNABLE인 채로 cpu에서 내려옴
+#define TRACE_DEMOTE   2 // pid가 level로 내려감 (arg: 사용한 allotment, us)
+#define TRACE_BOOST    3 // priority boost (arg: level 0으로 올라온 pgroup 수)
+#define TRACE_SLEEP    4 // pid가 잠듦
+#define TRACE_WAKEUP   5 // pid가 RUNNABLE이 됨
+#define TRACE_EXIT     6 // pid가 종료되어 cpu에서 내려옴
+
+struct traceevent
+{
+  uint64 time; // clockus()
+  int pid;
+  int arg;
+  uchar type;  // TRACE_*
+  uchar cpu;   // event를 기록한 cpu
+  char level;  // mlfq level, stride이면 -1
+};
@@ -1,30 +1,39 @@
 #define QFAILURE 1
 #define QSUCCESS 0
-#define MSIZE    NPROC + 1
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "mmu.h"
+#include "x86.h"
+#include "traps.h"
 #include "proc.h"
 #include "scheduler.h"
+#include "schedparam.h"
+#include "schedtrace.h"
 
-struct mlfqueue
+// sched_setparam으로 바꿀 수 있는 설정
+// 쓰기는 strideshare.lock을 잡고 하며, scheduler는 lock 없이 읽는다
+struct schedparam params;
+
+struct runqueue runqueues[NCPU];
+
+// cpu마다 하나씩 존재하는 scheduler event ring buffer
+// 자기 cpu만 interrupt가 꺼진 상태에서 기록하므로 lock이 필요 없다
+// head는 지금까지 기록된 event의 수이며, event는 head % NTRACE에 기록된다
+struct
 {
-  struct proc* q[MSIZE];
-  int rear;
-  int front;
-  int qsize;
-  int capacity;
-};
+  struct traceevent ev[NTRACE];
+  volatile uint head;
+} tracerings[NCPU];
 
+// 전체 cpu에서 stride process들이 점유한 ticket의 합
+// 각 cpu의 MLFQ가 최소한 params.minticket을 보장받도록 관리한다
 struct
 {
-  int quantum[NLEVEL];
-  int allotment[NLEVEL - 1];
-  int boostingperiod;
-  struct mlfqueue q[NLEVEL];
-} mlfq;
+  struct spinlock lock;
+  int totalusage;
+} strideshare;
 
 int pqparent(int index);
 int pqleftchild(int index);
@@ -34,26 +43,28 @@ struct pqelement pqtop(struct priorityqueue* pq);
 void pqshiftup(struct priorityqueue* pq, int index);
 void pqshiftdown(struct priorityqueue* pq, int index);
 int pqpush(struct priorityqueue* pq, struct pqelement element);
+void pqheapify(struct priorityqueue* pq);
 void pqupdatetop(struct priorityqueue* pq, struct pqelement element);
 int pqpop(struct priorityqueue* pq);
-void mlfqprint();
+void pqremove(struct priorityqueue* pq, int index);
+void mlfqprint(struct runqueue* rq);
 void mlfqinit();
-int mlfqisfull(int level);
-int mlfqisempty(int level);
 void mlfqremove(struct proc* p);
 void schedremoveproc(struct proc* p);
-void mlfqboost();
-int mlfqpush(struct proc* p);
+void mlfqboost(struct runqueue* rq);
+int mlfqpush(struct runqueue* rq, struct proc* p);
 int mlfqnext(struct proc* p, uint start, uint end);
-struct proc* mlfqtop();
-int mlfqenqueue(int level, struct proc* p);
-struct proc* mlfqueuetop(int level);
-int mlfqdequeue(int level);
-int mlfqueuesize(int level);
+struct proc* mlfqtop(struct runqueue* rq);
+void mlfqenqueue(struct runqueue* rq, int level, struct proc* p);
+void mlfqdequeue(struct runqueue* rq, struct proc* p);
+void mlfqpark(struct runqueue* rq, struct proc* p);
+void mlfqmove(struct runqueue* rq, struct proc* p, int level);
+static void schedkick(int cpu);
 void strideinit(struct stridescheduler* ss, int maxticket);
 int stridepush(struct stridescheduler* ss, void* value, int usage);
 void* stridetop(struct stridescheduler* ss);
 int stridefindindex(struct stridescheduler* ss, void* value);
+void stridenormalize(struct stridescheduler* ss);
 void strideupdateminusage(struct stridescheduler* ss);
 int stridechangeusage(struct stridescheduler* ss, int index, int usage);
 int strideremove(struct stridescheduler* ss, void* value);
@@ -64,9 +75,6 @@ void report_message(char* filename, const char* signature, int line,
                     char* message);
 void ps(void);
 
-struct stridescheduler mainstride;
-struct stridescheduler masterscheduler;
-
 #define assert(flag, message)                                \
   do                                                         \
   {                                                          \
@@ -91,6 +99,23 @@ int isvalidstateproc(struct proc* p)
   return p->state == SLEEPING || p->state == RUNNABLE || p->state == RUNNING;
 }
 
+// p가 배정된 run queue의 lock을 잡는다
+// lock을 잡는 사이에 p가 다른 cpu로 migrate 될 수 있으므로 다시 확인한다
+static struct runqueue*
+lockrq(struct proc* p)
+{
+  for (;;)
+  {
+    struct runqueue* rq = &runqueues[p->schedule.cpu];
+    acquire(&rq->lock);
+    if (rq == &runqueues[p->schedule.cpu])
+    {
+      return rq;
+    }
+    release(&rq->lock);
+  }
+}
+
 int
 pqparent(int index)
 {
@@ -142,33 +167,46 @@ get_runnable(struct proc* p)
   return 0;
 }
 
+// pgroup의 LWP 중 하나라도 어떤 cpu에서 실행 중인지 확인
+int
+is_pgroup_running(struct proc* p)
+{
+  for (struct linked_list* pos = p->pgroup.next; pos != &p->pgroup;
+       pos                     = pos->next)
+  {
+    if (container_of(pos, struct proc, pgroup)->state == RUNNING)
+    {
+      return 1;
+    }
+  }
+
+  return p->state == RUNNING;
+}
+
 void
 change_sched(struct proc* before, struct proc* after)
 {
+  struct runqueue* rq = lockrq(before);
   if (before->schedule.sched == SCHEDMLFQ)
   {
-    // mlfq
-    // TODO: linear search -> 비효율적
-    // TODO: mlfq를 linked list로, scheduler에 자신의 위치를 저장 등
-    for (int i = 0; i < MSIZE; ++i)
-    {
-      if (mlfq.q[before->schedule.level].q[i] == before)
-      {
-        mlfq.q[before->schedule.level].q[i] = after;
-      }
-    }
+    // mlfq: before의 자리에 after를 그대로 끼워 넣음 (O(1))
+    linked_list_insert(&after->schednode, before->schednode.prev,
+                       before->schednode.next);
+    linked_list_init(&before->schednode);
   }
   else
   {
-    for (int i = 0; i < masterscheduler.pq.size; ++i)
+    for (int i = 0; i < rq->mainstride.pq.size; ++i)
     {
-      if (masterscheduler.pq.data[i].value == before)
+      if (rq->mainstride.pq.data[i].value == before)
       {
-        masterscheduler.pq.data[i].value = after;
+        rq->mainstride.pq.data[i].value = after;
       }
     }
   }
+  after->schedule               = before->schedule;
   after->pgroup_current_execute = after;
+  release(&rq->lock);
 }
 
 void
@@ -223,6 +261,16 @@ pqpush(struct priorityqueue* pq, struct pqelement element)
   return 0;
 }
 
+// key를 여러 개 바꾼 뒤 heap을 다시 만든다
+void
+pqheapify(struct priorityqueue* pq)
+{
+  for (int index = pq->size / 2 - 1; index >= 0; --index)
+  {
+    pqshiftdown(pq, index);
+  }
+}
+
 void
 pqupdatetop(struct priorityqueue* pq, struct pqelement element)
 {
@@ -243,87 +291,175 @@ pqpop(struct priorityqueue* pq)
   return 0;
 }
 
-extern int sys_uptime(void);
+// index번째 원소를 제거
+void
+pqremove(struct priorityqueue* pq, int index)
+{
+  --pq->size;
+  if (index == pq->size)
+  {
+    return;
+  }
+  pq->data[index] = pq->data[pq->size];
+  pqshiftup(pq, index);
+  pqshiftdown(pq, index);
+}
+
+static void
+mlfqprintlist(struct linked_list* head)
+{
+  for (struct linked_list* pos = head->next; pos != head; pos = pos->next)
+  {
+    struct proc* p = container_of(pos, struct proc, schednode);
+    cprintf(" %d(%d)", p->pid, p->schedule.level);
+  }
+  cprintf("\n");
+}
 
 void
-mlfqprint()
+mlfqprint(struct runqueue* rq)
 {
+  cprintf("levelmask = %x\n", rq->levelmask);
   for (int level = 0; level < NLEVEL; ++level)
   {
-    cprintf("level = %d / %d, %d, %d", level, mlfq.q[level].rear,
-            mlfq.q[level].front, mlfq.q[level].qsize);
-    for (int j = 1; j <= mlfq.q[level].qsize; ++j)
-    {
-      cprintf(" %d(%d)",
-              mlfq.q[level]
-                  .q[(mlfq.q[level].front + j) % mlfq.q[level].capacity]
-                  ->pid,
-              mlfq.q[level]
-                  .q[(mlfq.q[level].front + j) % mlfq.q[level].capacity]
-                  ->schedule.level);
-    }
-    cprintf("\n");
+    cprintf("level = %d /", level);
+    mlfqprintlist(&rq->q[level]);
   }
+  cprintf("parked /");
+  mlfqprintlist(&rq->parked);
   cprintf("\n");
 }
 
 void
 mlfqinit()
 {
-  static int quantum[NLEVEL]       = { 5, 10, 20 };
-  static int allotment[NLEVEL - 1] = { 20, 40 };
+  static int quantum[NLEVEL]       = { 5 * TICKUS, 10 * TICKUS, 20 * TICKUS };
+  static int allotment[NLEVEL - 1] = { 20 * TICKUS, 40 * TICKUS };
   static int boostingperiod        = 200;
 
-  memset(&mlfq, 0, sizeof(mlfq));
-  memmove(mlfq.quantum, quantum, NLEVEL * sizeof(int));
-  memmove(mlfq.allotment, allotment, (NLEVEL - 1) * sizeof(int));
-  mlfq.boostingperiod = boostingperiod;
+  memset(&params, 0, sizeof(params));
+  memmove(params.quantum, quantum, NLEVEL * sizeof(int));
+  memmove(params.allotment, allotment, (NLEVEL - 1) * sizeof(int));
+  params.boostingperiod = boostingperiod;
+  params.stridequantum  = STRIDEQUANTUM;
+  params.minticket      = MLFQMINTICKET;
+  params.parallel       = 0;
+}
 
-  for (int level = 0; level < NLEVEL; ++level)
+void
+schedinit(void)
+{
+  mlfqinit();
+  initlock(&strideshare.lock, "strideshare");
+  strideshare.totalusage = 0;
+
+  for (struct runqueue* rq = runqueues; rq < &runqueues[NCPU]; ++rq)
   {
-    mlfq.q[level].front    = -1;
-    mlfq.q[level].rear     = -1;
-    mlfq.q[level].capacity = MSIZE;
+    memset(rq, 0, sizeof(*rq));
+    initlock(&rq->lock, "runqueue");
+    for (int level = 0; level < NLEVEL; ++level)
+    {
+      linked_list_init(&rq->q[level]);
+    }
+    linked_list_init(&rq->parked);
+
+    strideinit(&rq->masterscheduler, STRIDEMAXTICKET);
+    rq->masterscheduler.master = 1;
+    stridepush(&rq->masterscheduler, (void*)SCHEDMLFQ, STRIDEMAXTICKET);
+
+    strideinit(&rq->mainstride, STRIDEMAXTICKET - params.minticket);
   }
 }
 
-int
-mlfqisfull(int level)
+// p가 속한 run queue의 lock을 잡은 상태에서 호출해야 한다
+void
+mlfqremove(struct proc* p)
 {
-  return mlfq.q[level].qsize == (mlfq.q[level].capacity - 1);
+  assert(!p->schednode.next || p->schednode.next == &p->schednode,
+         "no proc");
+  mlfqdequeue(&runqueues[p->schedule.cpu], p);
 }
 
-int
-mlfqisempty(int level)
+// rq의 master scheduler에서 stride가 점유하는 ticket을 delta만큼 바꾼다
+// 나머지 ticket은 MLFQ가 가진다
+static void
+rqchangeshare(struct runqueue* rq, int delta)
 {
-  return !mlfq.q[level].qsize;
-}
+  struct stridescheduler* ms = &rq->masterscheduler;
+  int mlfqidx                = stridefindindex(ms, (void*)SCHEDMLFQ);
+  int strideidx              = stridefindindex(ms, (void*)SCHEDSTRIDE);
+  int strideusage = (strideidx == -1) ? 0 : ms->pq.data[strideidx].usage;
 
-void
-mlfqremove(struct proc* p)
-{
-  int flag  = 1;
-  int level = p->schedule.level;
-  for (int i = 0; i < mlfqueuesize(level); ++i)
+  int newstrideusage = strideusage + delta;
+  int newmlfqusage   = ms->maxticket - newstrideusage;
+
+  assert(newmlfqusage < params.minticket || newstrideusage < 0,
+         "invalid usage rate");
+
+  if (!delta)
   {
-    struct proc* t = mlfqueuetop(level);
-    assert(mlfqdequeue(level) == QFAILURE, "mlfqremove: mlfqdequeue failure");
+    return;
+  }
 
-    if (t != p)
-    {
-      assert(mlfqenqueue(level, t) == QFAILURE, "mlfqenqueue failure");
-    }
-    else
-    {
-      flag = 0;
-    }
+  if (strideidx == -1)
+  {
+    // totalusage가 maxticket을 넘지 않도록 MLFQ를 먼저 줄인다
+    assert(stridechangeusage(ms, mlfqidx, newmlfqusage),
+           "mlfqidx change failure");
+    assert(stridepush(ms, (void*)SCHEDSTRIDE, newstrideusage) == QFAILURE,
+           "stridepush failure");
+  }
+  else if (!newstrideusage)
+  {
+    assert(strideremove(ms, (void*)SCHEDSTRIDE) == -1,
+           "strideremove stridescheduler failure");
+    mlfqidx = stridefindindex(ms, (void*)SCHEDMLFQ);
+    assert(stridechangeusage(ms, mlfqidx, newmlfqusage),
+           "mlfqidx change failure");
+  }
+  else if (delta > 0)
+  {
+    assert(stridechangeusage(ms, mlfqidx, newmlfqusage),
+           "mlfqidx change failure");
+    assert(stridechangeusage(ms, strideidx, newstrideusage),
+           "strideidx change failure");
+  }
+  else
+  {
+    assert(stridechangeusage(ms, strideidx, newstrideusage),
+           "strideidx change failure");
+    assert(stridechangeusage(ms, mlfqidx, newmlfqusage),
+           "mlfqidx change failure");
   }
 
-  assert(flag, "no proc");
+  strideupdateminusage(ms);
 }
 
-void
-schedremoveproc(struct proc* p)
+// rq에 p를 추가한다. p->schedule의 level, sched, ticket을 유지한다
+// rq->lock을 잡은 상태에서 호출해야 한다
+static void
+rqinsert(struct runqueue* rq, struct proc* p)
+{
+  p->schedule.cpu = rq - runqueues;
+  switch (p->schedule.sched)
+  {
+  case SCHEDMLFQ:
+    mlfqenqueue(rq, p->schedule.level, p);
+    break;
+  case SCHEDSTRIDE:
+    assert(stridepush(&rq->mainstride, p, p->schedule.ticket) == QFAILURE,
+           "stridepush failure");
+    rqchangeshare(rq, p->schedule.ticket);
+    break;
+  default:
+    assert(1, "invalid sched");
+  }
+  ++rq->nproc;
+}
+
+// rq에서 p를 제거한다. rq->lock을 잡은 상태에서 호출해야 한다
+static void
+rqremove(struct runqueue* rq, struct proc* p)
 {
   switch (p->schedule.sched)
   {
@@ -331,136 +467,176 @@ schedremoveproc(struct proc* p)
     mlfqremove(p);
     break;
   case SCHEDSTRIDE: {
-    int usage = strideremove(&mainstride, p);
+    int usage = strideremove(&rq->mainstride, p);
     assert(usage == -1, "usage == -1");
-
-    int mlfqidx      = stridefindindex(&masterscheduler, (void*)SCHEDMLFQ);
-    int mlfqusage    = (int)masterscheduler.pq.data[mlfqidx].usage;
-    int newmlfqusage = mlfqusage + usage;
-
-    int strideidx      = stridefindindex(&masterscheduler, (void*)SCHEDSTRIDE);
-    int strideusage    = (int)masterscheduler.pq.data[strideidx].usage;
-    int newstrideusage = strideusage - usage;
-
-    assert(newmlfqusage + newstrideusage != masterscheduler.maxticket ||
-               newmlfqusage < 20 || newstrideusage < 0,
-           "invalid usage rate");
-
-    if (newstrideusage)
-    {
-      assert(stridechangeusage(&masterscheduler, strideidx, newstrideusage),
-             "strideidx change failure");
-      assert(stridechangeusage(&masterscheduler, mlfqidx, newmlfqusage),
-             "mlfqidx change failure");
-    }
-    else
-    {
-      assert(strideremove(&masterscheduler,
-                          masterscheduler.pq.data[strideidx].value) == -1,
-             "strideremove stridescheduler failure");
-      stridechangeusage(&masterscheduler, 0, 100);
-    }
-
-    strideupdateminusage(&masterscheduler);
+    rqchangeshare(rq, -usage);
     break;
   }
   default:
     assert(1, "invalid sched");
   }
+  --rq->nproc;
 }
 
 void
-mlfqboost()
+schedremoveproc(struct proc* p)
 {
-  struct proc* p = 0;
+  acquire(&strideshare.lock);
+  struct runqueue* rq = lockrq(p);
+  rqremove(rq, p);
+  if (p->schedule.sched == SCHEDSTRIDE)
+  {
+    strideshare.totalusage -= p->schedule.ticket;
+  }
+  release(&rq->lock);
+  release(&strideshare.lock);
+}
+
+void
+mlfqboost(struct runqueue* rq)
+{
+  int boosted = 0;
   for (int level = 1; level < NLEVEL; ++level)
   {
-    int capacity = mlfq.q[level].capacity;
-    int front    = mlfq.q[level].front;
-    for (int i = 0; i < mlfq.q[level].qsize; ++i)
+    while (!linked_list_is_empty(&rq->q[level]))
+    {
+      struct proc* p =
+          container_of(rq->q[level].next, struct proc, schednode);
+      p->schedule.executionus = 0;
+      mlfqmove(rq, p, 0);
+      ++boosted;
+    }
+  }
+
+  // parked된 pgroup은 깨어날 때 level 0으로 돌아온다
+  for (struct linked_list* pos = rq->parked.next; pos != &rq->parked;
+       pos                     = pos->next)
+  {
+    struct proc* p = container_of(pos, struct proc, schednode);
+    if (p->schedule.level)
     {
-      front                      = (front + 1) % capacity;
-      p                          = mlfq.q[level].q[front];
-      p->schedule.executionticks = 0;
-      mlfqenqueue(0, p);
+      ++boosted;
     }
-    mlfq.q[level].front = -1;
-    mlfq.q[level].rear  = -1;
-    mlfq.q[level].qsize = 0;
+    p->schedule.executionus = 0;
+    p->schedule.level       = 0;
   }
+
+  schedtrace(TRACE_BOOST, 0, boosted);
 }
 
 int
-mlfqpush(struct proc* p)
+mlfqpush(struct runqueue* rq, struct proc* p)
 {
   memset(&p->schedule, 0, sizeof(p->schedule));
   p->schedule.sched = SCHEDMLFQ;
-  if (mlfqenqueue(0, p) == QFAILURE)
-  {
-    return QFAILURE;
-  }
+  p->schedule.cpu   = rq - runqueues;
+  mlfqenqueue(rq, 0, p);
+  ++rq->nproc;
   return QSUCCESS;
 }
 
-extern void procdump(void);
+static inline int
+is_allowed(struct proc* p, int cpu)
+{
+  return (p->affinity >> cpu) & 1;
+}
 
-int
-mlfqrotatetotarget(int level, struct proc* p)
+// p의 affinity가 허용하는 cpu 중 가장 한가한 cpu의 run queue
+static struct runqueue*
+idlestrq(struct proc* p)
 {
-  for (int i = 0; i < mlfq.q[level].qsize; ++i)
+  struct runqueue* rq = 0;
+  for (int i = 0; i < ncpu; ++i)
   {
-    struct proc* top = mlfqueuetop(level);
-    if (top == p)
+    if (is_allowed(p, i) && (!rq || runqueues[i].nproc < rq->nproc))
     {
-      return QSUCCESS;
+      rq = &runqueues[i];
     }
-    assert(mlfqdequeue(level) == QFAILURE, "mlfqdequeue failure");
-    assert(mlfqenqueue(level, top) == QFAILURE, "mlfqenqueue failure");
   }
-  return QFAILURE;
+  return rq ? rq : &runqueues[0];
+}
+
+// 새 pgroup master를 가장 한가한 cpu의 run queue에 넣는다
+int
+schedpush(struct proc* p)
+{
+  struct runqueue* rq = idlestrq(p);
+
+  acquire(&rq->lock);
+  int result = mlfqpush(rq, p);
+  release(&rq->lock);
+  return result;
 }
 
+extern void procdump(void);
+
+// p가 속한 run queue의 lock을 잡은 상태에서 호출해야 한다
 int
 mlfqnext(struct proc* p, uint start, uint end)
 {
-  static uint nextboostingtick;
+  struct runqueue* rq = &runqueues[p->schedule.cpu];
   if (!isvalidstateproc(p))
   {
     return 1;
   }
 
-  int executiontick = end - start + ((p->schedule.yield) ? 1 : 0);
-  p->schedule.executionticks += executiontick;
+  // start, end는 clockus()이므로 실제로 사용한 시간만큼만 계산된다
+  uint executionus = end - start;
+  p->schedule.executionus += executionus;
 
-  int level           = p->schedule.level;
-  uint executionticks = p->schedule.executionticks;
+  int level = p->schedule.level;
 
-  if (level + 1 < NLEVEL && executionticks >= mlfq.allotment[level])
+  if (level + 1 < NLEVEL &&
+      p->schedule.executionus + TIMERSLACKUS >= params.allotment[level])
   {
-    assert(mlfqrotatetotarget(level, p) == QFAILURE, "rotate failure");
-    assert(mlfqdequeue(level) == QFAILURE, "mlfqpop failure");
-    assert(mlfqenqueue(level + 1, p) == QFAILURE, "mlfqpush failure");
-    p->schedule.executionticks = 0;
+    mlfqmove(rq, p, level + 1);
+    schedtrace(TRACE_DEMOTE, p, p->schedule.executionus);
+    p->schedule.executionus = 0;
     return 1;
   }
 
-  int result = (executiontick >= mlfq.quantum[level]) || p->schedule.yield || !get_runnable(p);
+  int result = (executionus + TIMERSLACKUS >= params.quantum[level]) ||
+               p->schedule.yield || !get_runnable(p);
   if (result)
   {
-    assert(mlfqrotatetotarget(level, p) == QFAILURE, "rotate failure");
-    assert(mlfqdequeue(level) == QFAILURE, "mlfqpop failure");
-    assert(mlfqenqueue(level, p) == QFAILURE, "mlfqpush failure");
+    mlfqmove(rq, p, level);
   }
 
-  if (nextboostingtick <= end)
+  if (rq->nextboostingtick <= ticks)
   {
-    mlfqboost();
-    nextboostingtick = end + mlfq.boostingperiod;
+    mlfqboost(rq);
+    rq->nextboostingtick = ticks + params.boostingperiod;
   }
 
   return result;
 }
 
+// 실행을 마친 p의 scheduling 정보를 갱신하고, 다음에도 p를 실행해도 되는지
+// 반환한다. ptable.lock을 잡은 상태에서 호출해야 한다
+int
+schednext(struct proc* p, uint start, uint end)
+{
+  struct runqueue* rq = lockrq(p);
+  int expired         = 1;
+
+  switch (p->schedule.sched)
+  {
+  case SCHEDMLFQ:
+    expired = mlfqnext(p, start, end);
+    break;
+
+  case SCHEDSTRIDE:
+    expired = 1;
+    break;
+
+  default:
+    panic("scheduler: invalid schedidx");
+  }
+
+  release(&rq->lock);
+  return expired;
+}
+
 int
 isexhaustedprocess(struct proc* p)
 {
@@ -470,114 +646,493 @@ isexhaustedprocess(struct proc* p)
   }
 
   // TODO: 쓰레드 yield 처리
-  if (p->schedule.sched == SCHEDMLFQ)
+  uint elapsed = (uint)clockus() - p->schedule.lastscheduledus;
+  return elapsed + TIMERSLACKUS >= schedslice(p);
+}
+
+// p가 이번 dispatch에서 쓸 수 있는 시간 (us)
+// mlfq는 quantum과 남은 allotment 중 작은 값이다
+uint
+schedslice(struct proc* p)
+{
+  if (p->schedule.sched != SCHEDMLFQ)
   {
-    return (sys_uptime() - p->schedule.lastscheduledtick) >=
-           mlfq.quantum[p->schedule.level];
+    return params.stridequantum;
   }
-  else
+
+  int level   = p->schedule.level;
+  uint result = params.quantum[level];
+  if (level + 1 < NLEVEL)
   {
-    // TODO: stride quantum을 option에서 선택할 수 있는 상수로
-    // cprintf("%d: %d\n", (sys_uptime() - p->schedule.lastscheduledtick),
-    // (sys_uptime() - p->schedule.lastscheduledtick) >= 5);
-    return (sys_uptime() - p->schedule.lastscheduledtick) >= 5;
+    uint allotment = params.allotment[level];
+    uint used      = p->schedule.executionus;
+    uint left      = (used < allotment) ? allotment - used : 0;
+    result         = (left < result) ? left : result;
+  }
+  return result;
+}
+
+// 가장 높은 level의 맨 앞에서 runnable한 pgroup master를 찾는다
+// runnable한 LWP가 없는 pgroup은 parked로 옮기고, 깨어날 때
+// schedwakeup()이 다시 q에 넣는다. 각 pgroup은 잠들 때마다 한 번씩만
+// park 되므로 amortized O(1)이다
+struct proc*
+mlfqtop(struct runqueue* rq)
+{
+  uint mask = rq->levelmask;
+  while (mask)
+  {
+    int level               = __builtin_ctz(mask);
+    struct linked_list* pos = rq->q[level].next;
+
+    // q에서 runnable한 프로세스를 찾음
+    while (pos != &rq->q[level])
+    {
+      struct proc* it = container_of(pos, struct proc, schednode);
+      pos             = pos->next;
+
+      if (get_runnable(it))
+      {
+        return it;
+      }
+
+      if (!is_pgroup_running(it))
+      {
+        mlfqpark(rq, it);
+      }
+    }
+
+    mask &= ~(1 << level);
   }
 
-  // not reached
   return 0;
 }
 
+// rq에서 다음에 실행할 pgroup master를 고른다
+// 직전에 실행한 p가 아직 만료되지 않았다면 p를 그대로 반환한다
+// ptable.lock 없이 호출하므로 반환된 p의 상태는 다시 확인해야 한다
 struct proc*
-mlfqtop()
+schedpick(struct runqueue* rq, struct proc* p, int expired)
 {
-  for (int level = 0; level < NLEVEL; ++level)
-  {
-    int size = mlfqueuesize(level);
+  acquire(&rq->lock);
+  int schedidx = (int)stridetop(&rq->masterscheduler);
 
-    // 해당 level이 비어 있음
-    if (!size)
+  if (!p || expired || p->state != RUNNABLE ||
+      p->schedule.sched != schedidx || &runqueues[p->schedule.cpu] != rq)
+  {
+    p = 0;
+    switch (schedidx)
     {
-      continue;
+    case SCHEDMLFQ: // mlfq
+      p = mlfqtop(rq);
+      if (p)
+      {
+        break;
+      }
+    case SCHEDSTRIDE: // stride
+      p = stridetop(&rq->mainstride);
+      if (p)
+      {
+        break;
+      }
+    default:
+      break;
+      // no process
     }
+  }
 
-    struct proc* it;
+  release(&rq->lock);
+  return p;
+}
 
-    // q에서 runnable한 프로세스틑 찾음
-    for (int i = 0; i < size; ++i)
+static int
+is_migratable(struct proc* p, struct runqueue* to, int runnable)
+{
+  if (is_pgroup_running(p) || !is_allowed(p, to - runqueues))
+  {
+    return 0;
+  }
+  return !runnable || get_runnable(p);
+}
+
+// from에서 옮길 수 있는 pgroup master를 하나 찾아 to로 옮긴다
+// runnable이 참이면 당장 실행 가능한 pgroup만 옮긴다
+// ptable.lock과 두 run queue의 lock을 잡은 상태에서 호출해야 한다
+static struct proc*
+rqpull(struct runqueue* to, struct runqueue* from, int runnable)
+{
+  struct proc* p = 0;
+
+  // 우선순위가 낮은 level부터 옮긴다
+  for (int level = NLEVEL; level >= 0 && !p; --level)
+  {
+    // level == NLEVEL: parked
+    struct linked_list* head =
+        (level == NLEVEL) ? &from->parked : &from->q[level];
+    if (level == NLEVEL && runnable)
     {
-      it = mlfqueuetop(level);
-      assert(!it, "invalid top");
+      continue;
+    }
 
-      if (get_runnable(it))
+    for (struct linked_list* pos = head->next; pos != head; pos = pos->next)
+    {
+      struct proc* it = container_of(pos, struct proc, schednode);
+      if (is_migratable(it, to, runnable))
       {
-        return it;
+        p = it;
+        break;
       }
+    }
+  }
 
-      // round robin
-      assert(mlfqdequeue(level) == QFAILURE, "mlfqdequeue failure");
-      assert(mlfqenqueue(level, it) == QFAILURE, "mlfqenqueue failure");
+  for (int i = 0; i < from->mainstride.pq.size && !p; ++i)
+  {
+    struct proc* it = from->mainstride.pq.data[i].value;
+    if (is_migratable(it, to, runnable))
+    {
+      p = it;
     }
   }
 
-  return 0;
+  if (p)
+  {
+    rqremove(from, p);
+    rqinsert(to, p);
+  }
+  return p;
 }
 
-int
-mlfqenqueue(int level, struct proc* p)
+// 두 run queue의 lock을 deadlock 없이 잡는다 (낮은 index 먼저)
+static void
+lockrqpair(struct runqueue* a, struct runqueue* b)
 {
-  if (mlfqisfull(level))
+  if (a < b)
   {
-    return QFAILURE;
+    acquire(&a->lock);
+    acquire(&b->lock);
   }
-  mlfq.q[level].rear = (mlfq.q[level].rear + 1) % mlfq.q[level].capacity;
-  mlfq.q[level].q[mlfq.q[level].rear] = p;
-  ++mlfq.q[level].qsize;
-  p->schedule.level = level;
-  p->schedule.yield = 0;
+  else
+  {
+    acquire(&b->lock);
+    acquire(&a->lock);
+  }
+}
 
-  return QSUCCESS;
+static void
+unlockrqpair(struct runqueue* a, struct runqueue* b)
+{
+  release(&a->lock);
+  release(&b->lock);
 }
 
+// 다른 cpu에 가져올 만한 pgroup이 있는지 lock 없이 확인한다
+int
+schedstealable(int cpu)
+{
+  for (int i = 0; i < ncpu; ++i)
+  {
+    if (i != cpu && runqueues[i].nproc >= 2)
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// cpu의 run queue가 비었을 때 다른 cpu에서 실행 가능한 pgroup을 가져온다
+// ptable.lock을 잡은 상태에서 호출해야 한다
 struct proc*
-mlfqueuetop(int level)
+schedsteal(int cpu)
+{
+  struct runqueue* rq = &runqueues[cpu];
+  for (int i = 1; i < ncpu; ++i)
+  {
+    struct runqueue* victim = &runqueues[(cpu + i) % ncpu];
+
+    // 하나뿐인 pgroup은 victim cpu가 직접 실행한다
+    if (victim->nproc < 2)
+    {
+      continue;
+    }
+
+    lockrqpair(rq, victim);
+    struct proc* p = rqpull(rq, victim, 1);
+    unlockrqpair(rq, victim);
+    if (p)
+    {
+      return p;
+    }
+  }
+  return 0;
+}
+
+// p의 pgroup이 affinity가 허용하지 않는 cpu에 있다면 허용하는 cpu로 옮긴다
+// 실행 중인 pgroup은 옮기지 않으며, 실행을 마친 뒤 scheduler()가 다시 호출한다
+// ptable.lock을 잡은 상태에서 호출해야 한다
+void
+schedmigrate(struct proc* p)
 {
-  return mlfqisempty(level)
-             ? 0
-             : mlfq.q[level]
-                   .q[(mlfq.q[level].front + 1) % mlfq.q[level].capacity];
+  p = p->pgroup_master;
+  if (is_allowed(p, p->schedule.cpu) || is_pgroup_running(p))
+  {
+    return;
+  }
+
+  struct runqueue* from = &runqueues[p->schedule.cpu];
+  struct runqueue* to   = idlestrq(p);
+  lockrqpair(from, to);
+  rqremove(from, p);
+  rqinsert(to, p);
+  unlockrqpair(from, to);
+  schedkick(to - runqueues);
 }
 
+// p의 pgroup 전체의 affinity를 바꾼다
+// ptable.lock을 잡은 상태에서 호출해야 한다
 int
-mlfqdequeue(int level)
+schedsetaffinity(struct proc* p, uint mask)
 {
-  if (mlfqisempty(level))
+  mask &= (ncpu < 32) ? (1U << ncpu) - 1 : AFFINITYALL;
+  if (!mask)
   {
-    return QFAILURE;
+    return -1;
   }
-  mlfq.q[level].front = (mlfq.q[level].front + 1) % mlfq.q[level].capacity;
-  --mlfq.q[level].qsize;
-  return QSUCCESS;
+
+  struct proc* master = p->pgroup_master;
+  master->affinity    = mask;
+  for (struct linked_list* pos = master->pgroup.next; pos != &master->pgroup;
+       pos                     = pos->next)
+  {
+    container_of(pos, struct proc, pgroup)->affinity = mask;
+  }
+
+  schedmigrate(master);
+  return 0;
 }
 
+// parallel mode에서 cpu가 빌려 실행할 LWP가 있을 수도 있는지 확인한다
+// lock 없이 확인하므로 실제로 고르는 것은 ptable.lock을 잡고 다시 한다
 int
-mlfqueuesize(int level)
+schedhelpable(int cpu)
+{
+  if (!params.parallel)
+  {
+    return 0;
+  }
+
+  for (int i = 0; i < ncpu; ++i)
+  {
+    struct proc* p = cpus[i].proc;
+    if (i != cpu && p && !cpus[i].helping &&
+        !linked_list_is_empty(&p->pgroup_master->pgroup))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// 다른 cpu가 빌려 실행한 시간 us를 p의 pgroup에 청구한다
+// mlfq는 allotment를, stride는 pass를 실행한 시간만큼 소모한다
+// ptable.lock을 잡은 상태에서 호출해야 한다
+void
+schedcharge(struct proc* p, uint us)
+{
+  struct runqueue* rq = lockrq(p);
+  if (p->schedule.sched == SCHEDMLFQ)
+  {
+    p->schedule.executionus += us;
+  }
+  else
+  {
+    struct stridescheduler* ss = &rq->mainstride;
+    int index                  = stridefindindex(ss, p);
+    if (index != -1)
+    {
+      struct pqelement* e = &ss->pq.data[index];
+      e->key += divu64((uint64)ss->stride[e->usage] * us, params.stridequantum);
+      pqshiftdown(&ss->pq, index);
+    }
+  }
+  release(&rq->lock);
+}
+
+// 가장 많은 pgroup을 가진 cpu에서 하나를 가져와 부하를 맞춘다
+// ptable.lock을 잡은 상태에서 호출해야 한다
+void
+schedbalance(int cpu)
+{
+  struct runqueue* rq      = &runqueues[cpu];
+  struct runqueue* busiest = 0;
+
+  rq->nextbalancetick = ticks + BALANCEPERIOD;
+  for (int i = 0; i < ncpu; ++i)
+  {
+    if (i != cpu && (!busiest || runqueues[i].nproc > busiest->nproc))
+    {
+      busiest = &runqueues[i];
+    }
+  }
+
+  if (!busiest || busiest->nproc - rq->nproc < 2)
+  {
+    return;
+  }
+
+  lockrqpair(rq, busiest);
+  if (busiest->nproc - rq->nproc >= 2)
+  {
+    rqpull(rq, busiest, 0);
+  }
+  unlockrqpair(rq, busiest);
+}
+
+// p를 q[level]의 맨 뒤에 넣는다
+void
+mlfqenqueue(struct runqueue* rq, int level, struct proc* p)
 {
-  return mlfq.q[level].qsize;
+  linked_list_init(&p->schednode);
+  linked_list_push_back(&p->schednode, &rq->q[level]);
+  rq->levelmask |= 1 << level;
+  p->schedule.level  = level;
+  p->schedule.yield  = 0;
+  p->schedule.parked = 0;
+}
+
+// p를 q 또는 parked에서 뺀다
+void
+mlfqdequeue(struct runqueue* rq, struct proc* p)
+{
+  int level = p->schedule.level;
+  linked_list_remove(&p->schednode);
+  linked_list_init(&p->schednode);
+  if (!p->schedule.parked && linked_list_is_empty(&rq->q[level]))
+  {
+    rq->levelmask &= ~(1 << level);
+  }
+  p->schedule.parked = 0;
+}
+
+void
+mlfqpark(struct runqueue* rq, struct proc* p)
+{
+  mlfqdequeue(rq, p);
+  linked_list_push_back(&p->schednode, &rq->parked);
+  p->schedule.parked = 1;
+}
+
+// p를 q[level]의 맨 뒤로 옮긴다. parked라면 level만 바꾼다
+void
+mlfqmove(struct runqueue* rq, struct proc* p, int level)
+{
+  if (p->schedule.parked)
+  {
+    p->schedule.level = level;
+    p->schedule.yield = 0;
+    return;
+  }
+  mlfqdequeue(rq, p);
+  mlfqenqueue(rq, level, p);
+}
+
+// p의 상태가 RUNNABLE이 된 뒤 ptable.lock을 잡은 상태에서 호출한다
+// p의 pgroup이 parked라면 다시 q에 넣는다
+// mlfqtop()은 rq->lock을 잡고 park 여부를 결정하므로, 여기서도 항상
+// rq->lock을 잡아야 wakeup을 놓치지 않는다
+void
+schedwakeup(struct proc* p)
+{
+  struct proc* master = p->pgroup_master;
+  if (!master)
+  {
+    return;
+  }
+
+  struct runqueue* rq = lockrq(master);
+  if (master->schedule.sched == SCHEDMLFQ && master->schedule.parked)
+  {
+    mlfqdequeue(rq, master);
+    mlfqenqueue(rq, master->schedule.level, master);
+  }
+  release(&rq->lock);
+
+  schedkick(master->schedule.cpu);
+}
+
+// cpu의 run queue에 당장 실행할 수 있는 pgroup이 있는지 확인한다
+// schedpick()과 달리 run queue를 바꾸지 않는다
+int
+schedhasrunnable(int cpu)
+{
+  struct runqueue* rq = &runqueues[cpu];
+  int result          = 0;
+
+  acquire(&rq->lock);
+  for (int level = 0; level < NLEVEL && !result; ++level)
+  {
+    for (struct linked_list* pos = rq->q[level].next;
+         pos != &rq->q[level] && !result; pos = pos->next)
+    {
+      result = get_runnable(container_of(pos, struct proc, schednode)) != 0;
+    }
+  }
+  for (int i = 0; i < rq->mainstride.pq.size && !result; ++i)
+  {
+    result = get_runnable(rq->mainstride.pq.data[i].value) != 0;
+  }
+  release(&rq->lock);
+
+  return result;
+}
+
+// cpu에 실행할 pgroup이 생겼을 때 hlt 중인 cpu를 IPI로 깨운다
+// cpu가 이미 바쁘다면 idle cpu 하나를 깨워 steal 하도록 한다
+// ptable.lock을 잡은 상태에서 호출해야 한다
+static void
+schedkick(int cpu)
+{
+  int self = cpuid();
+
+  if (cpus[cpu].idle)
+  {
+    if (cpu != self)
+    {
+      lapicipi(cpus[cpu].apicid, T_IRQ0 + IRQ_WAKEUP);
+    }
+    return;
+  }
+
+  // parallel mode에서는 같은 pgroup의 LWP도 나눠 실행할 수 있다
+  if (runqueues[cpu].nproc < 2 && !params.parallel)
+  {
+    return;
+  }
+
+  for (int i = 0; i < ncpu; ++i)
+  {
+    if (i != self && i != cpu && cpus[i].idle)
+    {
+      lapicipi(cpus[i].apicid, T_IRQ0 + IRQ_WAKEUP);
+      return;
+    }
+  }
 }
 
 void
 strideinit(struct stridescheduler* ss, int maxticket)
 {
   pqinit(&ss->pq);
-  initlock(&ss->lock, "stridescheduler");
   ss->totalusage = 0;
   ss->maxticket  = maxticket;
+  ss->master     = 0;
+  ss->vtime      = 0;
 
   ss->stride[0] = 0;
   ss->minusage  = 100;
-  for (int i = 1; i <= maxticket; ++i)
+  // maxticket은 sched_setparam으로 늘어날 수 있으므로 전부 계산해 둔다
+  for (int i = 1; i <= STRIDEMAXTICKET; ++i)
   {
-    ss->stride[i] = (double)1 / i;
+    ss->stride[i] = STRIDELARGE / i;
   }
 }
 
@@ -595,10 +1150,8 @@ stridepush(struct stridescheduler* ss, void* value, int usage)
     ss->minusage = usage;
   }
 
-  int min = ss->pq.size ? pqtop(&ss->pq).key : 0;
-
   struct pqelement element;
-  element.key   = min + ss->stride[ss->minusage];
+  element.key   = ss->vtime + ss->stride[ss->minusage];
   element.value = value;
   element.usage = usage;
 
@@ -610,11 +1163,19 @@ stridepush(struct stridescheduler* ss, void* value, int usage)
 void*
 stridetop(struct stridescheduler* ss)
 {
-  if (ss == &masterscheduler)
+  if (ss->master)
   {
     struct pqelement result = pqtop(&ss->pq);
+    if (ss->vtime < result.key)
+    {
+      ss->vtime = result.key;
+    }
     result.key += ss->stride[(int)result.usage];
     pqupdatetop(&ss->pq, result);
+    if (ss->vtime >= STRIDERENORM)
+    {
+      stridenormalize(ss);
+    }
     return result.value;
   }
   else
@@ -626,30 +1187,76 @@ stridetop(struct stridescheduler* ss)
     }
 
     int minidx      = -1;
-    double minvalue = ss->pq.data[ss->pq.size - 1].key;
+    int clamped     = 0;
+    uint64 minvalue = 0;
 
     for (int i = 0; i < ss->pq.size; ++i)
     {
-      if (ss->pq.data[i].key <= minvalue &&
-          get_runnable((struct proc*)ss->pq.data[i].value))
+      struct pqelement* e = &ss->pq.data[i];
+      if (!get_runnable((struct proc*)e->value))
       {
-        minvalue = ss->pq.data[i].key;
+        continue;
+      }
+      // 잠들어 있던 동안 쌓인 몫은 버린다: pass를 vtime - stride까지 끌어올린다
+      uint stride = ss->stride[(int)e->usage];
+      if (ss->vtime > stride && e->key < ss->vtime - stride)
+      {
+        e->key  = ss->vtime - stride;
+        clamped = 1;
+      }
+      if (minidx == -1 || e->key < minvalue)
+      {
+        minvalue = e->key;
         minidx   = i;
       }
     }
+    struct proc* result = minidx == -1 ? 0 : ss->pq.data[minidx].value;
+    if (clamped)
+    {
+      // heapify가 항목을 옮기므로 고른 항목을 다시 찾는다
+      pqheapify(&ss->pq);
+      minidx = result ? stridefindindex(ss, result) : -1;
+    }
     if (minidx == -1)
     {
       return 0;
     }
 
-    struct proc* result = ss->pq.data[minidx].value;
+    if (ss->vtime < minvalue)
+    {
+      ss->vtime = minvalue;
+    }
     ss->pq.data[minidx].key += ss->stride[(int)ss->pq.data[minidx].usage];
     pqshiftdown(&ss->pq, minidx);
+    if (ss->vtime >= STRIDERENORM)
+    {
+      stridenormalize(ss);
+    }
 
     return result;
   }
 }
 
+// 모든 pass와 vtime을 vtime - STRIDELARGE만큼 당긴다
+void
+stridenormalize(struct stridescheduler* ss)
+{
+  if (ss->vtime < STRIDELARGE)
+  {
+    return;
+  }
+
+  // vtime - STRIDELARGE보다 작은 pass는 잠든 항목의 것이고 고를 때 어차피
+  // 끌어올려지므로 0으로 둔다. 단조 증가 변환이므로 heap은 유지된다
+  uint64 base = ss->vtime - STRIDELARGE;
+  for (int i = 0; i < ss->pq.size; ++i)
+  {
+    struct pqelement* e = &ss->pq.data[i];
+    e->key              = e->key > base ? e->key - base : 0;
+  }
+  ss->vtime -= base;
+}
+
 // failure: return -1
 int
 stridefindindex(struct stridescheduler* ss, void* value)
@@ -729,11 +1336,8 @@ strideremove(struct stridescheduler* ss, void* value)
     return -1;
   }
 
-  int usage             = (int)ss->pq.data[find].usage;
-  ss->pq.data[find].key = -1;
-
-  pqshiftup(&ss->pq, find);
-  pqpop(&ss->pq);
+  int usage = (int)ss->pq.data[find].usage;
+  pqremove(&ss->pq, find);
 
   ss->totalusage -= usage;
 
@@ -751,7 +1355,7 @@ strideremove(struct stridescheduler* ss, void* value)
 void
 strideprint(struct stridescheduler* stride)
 {
-  cprintf("[%s]\n", ((stride == &masterscheduler) ? "master" : "stride"));
+  cprintf("[%s]\n", (stride->master ? "master" : "stride"));
   cprintf("maxticket: %d\nminusage: %d\ntotalusage: %d\n", stride->maxticket,
           stride->minusage, stride->totalusage);
   pqprint(&stride->pq);
@@ -764,8 +1368,9 @@ pqprint(struct priorityqueue* pq)
   cprintf("size: %d\n", pq->size);
   for (int index = 0; index < pq->size; ++index)
   {
-    cprintf("%d(%p, %d) ", (int)(pq->data[index].key * 100),
-            pq->data[index].value, pq->data[index].usage);
+    cprintf("%x:%x(%p, %d) ", (uint)(pq->data[index].key >> 32),
+            (uint)pq->data[index].key, pq->data[index].value,
+            pq->data[index].usage);
   }
   cprintf("\n");
 }
@@ -773,80 +1378,172 @@ pqprint(struct priorityqueue* pq)
 int
 set_cpu_share(struct proc* p, int usage)
 {
-  acquire(&masterscheduler.lock);
   p = p->pgroup_master;
-  if (p->schedule.sched != SCHEDMLFQ)
+  if (usage <= 0)
   {
-    // MLFQ가 최소한 MLFQMINTICKET 만큼의 ticket을 점유해야 한다
-    int mlfqidx   = stridefindindex(&masterscheduler, (void*)SCHEDMLFQ);
-    int strideidx = stridefindindex(&masterscheduler, (void*)SCHEDSTRIDE);
-    int mlfqusage = (int)masterscheduler.pq.data[mlfqidx].usage;
-
-    int old_usage = mainstride.pq.data[stridefindindex(&mainstride, p)].usage;
-
-    int newmlfqusage = mlfqusage + old_usage - usage;
-    if (newmlfqusage < MLFQMINTICKET)
-    {
-      return -2;
-    }
+    return -3;
+  }
 
-    int strideusage    = (int)masterscheduler.pq.data[strideidx].usage;
-    int newstrideusage = strideusage - old_usage + usage;
+  acquire(&strideshare.lock);
+  int oldusage =
+      (p->schedule.sched == SCHEDSTRIDE) ? p->schedule.ticket : 0;
 
-    assert(newmlfqusage + newstrideusage != masterscheduler.maxticket,
-           "invalid ticket");
+  // MLFQ가 최소한 params.minticket 만큼의 ticket을 점유해야 한다
+  // 모든 cpu의 stride ticket 합으로 검사하므로 각 cpu에서도 보장된다
+  int newtotal = strideshare.totalusage - oldusage + usage;
+  if (STRIDEMAXTICKET - newtotal < params.minticket)
+  {
+    release(&strideshare.lock);
+    return -2;
+  }
 
-    assert(stridechangeusage(&masterscheduler, strideidx, newstrideusage),
-           "strridechangeusage failure");
-    mlfqidx = stridefindindex(&masterscheduler, (void*)SCHEDMLFQ);
-    assert(stridechangeusage(&masterscheduler, mlfqidx, newmlfqusage),
+  struct runqueue* rq = lockrq(p);
+  if (oldusage)
+  {
+    assert(stridechangeusage(&rq->mainstride,
+                             stridefindindex(&rq->mainstride, p), usage),
            "stridechangeusage failure");
-    assert(
-        stridechangeusage(&mainstride, stridefindindex(&mainstride, p), usage),
-        "stridechangeusage failure");
-    release(&masterscheduler.lock);
-    return 0;
+    rqchangeshare(rq, usage - oldusage);
+  }
+  else
+  {
+    mlfqremove(p);
+    p->schedule.sched  = SCHEDSTRIDE;
+    p->schedule.ticket = usage;
+    assert(stridepush(&rq->mainstride, p, usage) == QFAILURE,
+           "stridepush failure");
+    rqchangeshare(rq, usage);
   }
+  p->schedule.ticket     = usage;
+  strideshare.totalusage = newtotal;
 
-  // MLFQ가 최소한 MLFQMINTICKET 만큼의 ticket을 점유해야 한다
-  int mlfqidx      = stridefindindex(&masterscheduler, (void*)SCHEDMLFQ);
-  int mlfqusage    = (int)masterscheduler.pq.data[mlfqidx].usage;
-  int newmlfqusage = mlfqusage - usage;
+  release(&rq->lock);
+  release(&strideshare.lock);
+  return 0;
+}
+
+void
+sched_getparam(struct schedparam* param)
+{
+  acquire(&strideshare.lock);
+  *param = params;
+  release(&strideshare.lock);
+}
+
+// 잘못된 값이 있으면 -1, 이미 stride process들이 점유한 ticket 때문에
+// minticket을 보장할 수 없으면 -2를 반환한다
+int
+sched_setparam(struct schedparam* param)
+{
+  for (int level = 0; level < NLEVEL; ++level)
+  {
+    if (param->quantum[level] <= 0)
+    {
+      return -1;
+    }
+  }
+  for (int level = 0; level < NLEVEL - 1; ++level)
+  {
+    if (param->allotment[level] < param->quantum[level])
+    {
+      return -1;
+    }
+  }
+  if (param->boostingperiod <= 0 || param->stridequantum <= 0 ||
+      param->minticket <= 0 || param->minticket >= STRIDEMAXTICKET ||
+      (param->parallel != 0 && param->parallel != 1))
+  {
+    return -1;
+  }
 
-  if (newmlfqusage < MLFQMINTICKET)
+  acquire(&strideshare.lock);
+  if (STRIDEMAXTICKET - strideshare.totalusage < param->minticket)
   {
+    release(&strideshare.lock);
     return -2;
   }
 
-  if (stridepush(&mainstride, p, usage) == QFAILURE)
+  // 각 cpu의 stride ticket 합은 전체 합보다 작으므로 항상 들어맞는다
+  for (int cpu = 0; cpu < ncpu; ++cpu)
   {
-    return -3;
+    struct runqueue* rq = &runqueues[cpu];
+    acquire(&rq->lock);
+    rq->mainstride.maxticket = STRIDEMAXTICKET - param->minticket;
+    release(&rq->lock);
   }
+  params = *param;
+  release(&strideshare.lock);
+  return 0;
+}
 
-  // newmlfqusage는 0일 수 없음. 따라서 따로 처리 x
-  assert(stridechangeusage(&masterscheduler, mlfqidx, newmlfqusage),
-         "strridechangeusage failure");
+// 이 cpu의 ring buffer에 event를 기록한다
+// p가 0이 아니면 p의 pid와 p가 속한 pgroup의 level을 함께 기록한다
+void
+schedtrace(int type, struct proc* p, int arg)
+{
+  pushcli();
+  struct proc* master  = p ? p->pgroup_master : 0;
+  int cpu              = mycpu() - cpus;
+  uint head            = tracerings[cpu].head;
+  struct traceevent* e = &tracerings[cpu].ev[head % NTRACE];
+
+  e->time  = clockus();
+  e->pid   = p ? p->pid : 0;
+  e->arg   = arg;
+  e->type  = type;
+  e->cpu   = cpu;
+  e->level = (master && master->schedule.sched == SCHEDMLFQ)
+                 ? master->schedule.level
+                 : -1;
+
+  // event를 다 쓴 뒤에 head를 늘려야 읽는 쪽이 반쯤 쓴 event를 보지 않는다
+  __sync_synchronize();
+  tracerings[cpu].head = head + 1;
+  popcli();
+}
 
-  int strideidx = stridefindindex(&masterscheduler, (void*)SCHEDSTRIDE);
-  if (strideidx == -1)
+// cpu의 event 중 *seq번째부터 최대 n개를 buf로 복사하고 복사한 수를 반환한다
+// *seq는 다음에 읽을 번호로 바뀐다. 이미 덮어쓰인 event는 건너뛰므로
+// 돌려받은 *seq와 반환값으로 놓친 event의 수를 알 수 있다
+// *seq가 TRACE_NOW이면 지금까지의 event를 건너뛴다
+int
+schedtraceread(int cpu, uint* seq, struct traceevent* buf, int n)
+{
+  if (cpu < 0 || cpu >= ncpu || n < 0)
   {
-    assert(stridepush(&masterscheduler, (void*)SCHEDSTRIDE, usage) == QFAILURE,
-           "stridepush failure");
-    strideidx = stridefindindex(&masterscheduler, (void*)SCHEDSTRIDE);
+    return -1;
   }
-  else
+
+  uint head = tracerings[cpu].head;
+  uint from = *seq;
+  if (from == TRACE_NOW || from > head)
   {
-    int strideusage    = (int)masterscheduler.pq.data[strideidx].usage;
-    int newstrideusage = strideusage + usage;
+    *seq = head;
+    return 0;
+  }
+  if (head - from > NTRACE)
+  {
+    from = head - NTRACE;
+  }
 
-    assert(newmlfqusage + newstrideusage != masterscheduler.maxticket,
-           "invalid ticket");
-    assert(stridechangeusage(&masterscheduler, strideidx, newstrideusage),
-           "stridechangeusage failure");
+  int count = (head - from < (uint)n) ? head - from : n;
+  for (int i = 0; i < count; ++i)
+  {
+    buf[i] = tracerings[cpu].ev[(from + i) % NTRACE];
   }
 
-  mlfqremove(p);
-  p->schedule.sched = SCHEDSTRIDE;
-  release(&masterscheduler.lock);
-  return 0;
-}
\ No newline at end of file
+  // 복사하는 사이에 덮어쓰인 event를 버린다
+  __sync_synchronize();
+  head = tracerings[cpu].head;
+  if (head - from > NTRACE)
+  {
+    int lost = head - NTRACE - from;
+    lost     = (lost > count) ? count : lost;
+    memmove(buf, buf + lost, (count - lost) * sizeof(*buf));
+    from += lost;
+    count -= lost;
+  }
+
+  *seq = from + count;
+  return count;
+}
@@ -1,6 +1,7 @@
 #ifndef __SCHEDULER_H__
 #define __SCHEDULER_H__
 
+#include "linked_list.h"
 #include "spinlock.h"
 
 typedef unsigned int uint;
@@ -8,10 +9,24 @@ struct proc;
 
 #define PQCAPACITY      NPROC
 #define STRIDEMAXTICKET 100
+#define BALANCEPERIOD   20
+#define STRIDEQUANTUM   (5 * TICKUS) // us
+#define TIMERSLACKUS    50 // quantum이 이만큼 남았으면 만료된 것으로 본다
+#define AFFINITYALL     0xFFFFFFFF
+
+// pass 값은 고정소수점 정수: stride = STRIDELARGE / ticket
+// vtime은 마지막으로 고른 항목의 pass다. 잠들었다 깨어난 항목은 고를 때
+// pass를 vtime - stride 이상으로 끌어올리므로, runnable한 항목의 pass는
+// vtime에서 한두 stride 안쪽에 있다
+// vtime이 STRIDERENORM을 넘으면 모든 pass와 vtime에서 vtime - STRIDELARGE를
+// 뺀다. 한 번 고를 때 vtime은 많아야 약 2 * STRIDELARGE 늘어나므로 정규화는
+// 많아야 약 STRIDERENORM / (2 * STRIDELARGE) (= 2048)번에 한 번 일어난다
+#define STRIDELARGE  (1 << 20)
+#define STRIDERENORM (1ULL << 32)
 
 struct pqelement
 {
-  double key;
+  uint64 key;
   void* value;
   int usage;
 };
@@ -29,19 +44,48 @@ struct stridescheduler
   int totalusage;
   int maxticket;
   int minusage;
-  double stride[STRIDEMAXTICKET + 1];
+  int master;
+  uint64 vtime; // 마지막으로 고른 항목의 pass
+  uint stride[STRIDEMAXTICKET + 1];
+};
+
+// cpu마다 하나씩 존재하는 run queue
+// lock은 q, parked, mainstride, masterscheduler를 보호한다
+struct runqueue
+{
   struct spinlock lock;
+  struct linked_list q[NLEVEL]; // proc.schednode의 list
+  struct linked_list parked;    // runnable한 LWP가 없는 pgroup master
+  uint levelmask;               // q[level]이 비어있지 않으면 level번 bit가 1
+  struct stridescheduler mainstride;
+  struct stridescheduler masterscheduler;
+  int nproc; // 이 cpu에 배정된 pgroup master의 수
+  uint nextboostingtick;
+  uint nextbalancetick;
 };
 
+extern struct runqueue runqueues[NCPU];
+
 int isexhaustedprocess(struct proc*);
+uint schedslice(struct proc*);
 struct proc* get_runnable(struct proc*);
+int is_pgroup_running(struct proc*);
 void change_sched(struct proc*, struct proc*);
+void schedwakeup(struct proc*);
+int schedhasrunnable(int);
+
+void schedinit(void);
+int schedpush(struct proc*);
+struct proc* schedpick(struct runqueue*, struct proc*, int);
+int schednext(struct proc*, uint, uint);
+int schedstealable(int);
+struct proc* schedsteal(int);
+void schedbalance(int);
 
 void mlfqinit();
-int mlfqpush(struct proc*);
-struct proc* mlfqtop();
+struct proc* mlfqtop(struct runqueue*);
 int mlfqnext(struct proc*, uint, uint);
-void mlfqboost();
+void mlfqboost(struct runqueue*);
 
 void strideinit(struct stridescheduler*, int);
 int stridepush(struct stridescheduler*, void*, int);
@@ -49,8 +93,20 @@ void* stridetop(struct stridescheduler*);
 
 void schedremoveproc(struct proc*);
 int set_cpu_share(struct proc*, int);
+int schedsetaffinity(struct proc*, uint);
+void schedmigrate(struct proc*);
+int schedhelpable(int);
+void schedcharge(struct proc*, uint);
+
+struct traceevent;
+void schedtrace(int, struct proc*, int);
+int schedtraceread(int, uint*, struct traceevent*, int);
+
+struct schedparam;
+void sched_getparam(struct schedparam*);
+int sched_setparam(struct schedparam*);
 
-void mlfqprint();
+void mlfqprint(struct runqueue*);
 void strideprint(struct stridescheduler* stride);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,255 @@
+// 크기가 고정된 kernel object를 위한 slab allocator
+// page 하나를 slab으로 쓰며, page 맨 앞에 slab header가 있고 그 뒤에
+// object가 이어진다. object를 free할 때는 PGROUNDDOWN으로 slab을 찾는다
+//
+// cpu마다 free object 몇 개를 따로 들고 있어서 보통의 alloc/free는
+// 자기 cpu의 lock만 잡는다. 모자라거나 넘치면 SLABBATCH개씩
+// cache->lock을 잡고 slab과 주고받는다
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+
+#define NSLABCACHE 8
+#define SLABMAG    16 // cpu마다 들고 있는 free object의 최대 개수
+#define SLABBATCH  8
+
+struct slabobj
+{
+  struct slabobj* next;
+};
+
+struct slab
+{
+  struct kmem_cache* cache;
+  struct slab* prev; // cache->partial list
+  struct slab* next;
+  struct slabobj* free;
+  int inuse;
+};
+
+struct slabcpu
+{
+  struct spinlock lock;
+  void* obj[SLABMAG];
+  int n;
+};
+
+struct kmem_cache
+{
+  struct spinlock lock; // partial, nslab을 보호한다
+  char* name;
+  uint size;   // 8 byte로 맞춘 object 크기
+  uint perslab;
+  struct slab* partial; // free object가 남은 slab
+  int nslab;
+  struct slabcpu cpu[NCPU];
+};
+
+struct
+{
+  struct spinlock lock;
+  struct kmem_cache cache[NSLABCACHE];
+  int n;
+} slabcaches;
+
+void
+slabinit(void)
+{
+  initlock(&slabcaches.lock, "slabcaches");
+}
+
+// size byte짜리 object의 cache를 만든다
+struct kmem_cache*
+kmem_cache_create(char* name, uint size)
+{
+  struct kmem_cache* c;
+
+  size = (size + 7) & ~7;
+  if (size < sizeof(struct slabobj) ||
+      size > PGSIZE - sizeof(struct slab))
+  {
+    panic("kmem_cache_create: size");
+  }
+
+  acquire(&slabcaches.lock);
+  if (slabcaches.n == NSLABCACHE)
+  {
+    panic("kmem_cache_create: too many caches");
+  }
+  c = &slabcaches.cache[slabcaches.n++];
+  release(&slabcaches.lock);
+
+  initlock(&c->lock, name);
+  c->name    = name;
+  c->size    = size;
+  c->perslab = (PGSIZE - sizeof(struct slab)) / size;
+  c->partial = 0;
+  c->nslab   = 0;
+  for (int i = 0; i < NCPU; ++i)
+  {
+    initlock(&c->cpu[i].lock, name);
+    c->cpu[i].n = 0;
+  }
+  return c;
+}
+
+// 새 page로 slab을 만들어 partial list에 넣는다
+// cache->lock을 잡은 상태로 호출해야 한다
+static struct slab*
+slabgrow(struct kmem_cache* c)
+{
+  struct slab* s = (struct slab*)kalloc();
+  if (!s)
+  {
+    return 0;
+  }
+
+  s->cache = c;
+  s->inuse = 0;
+  s->free  = 0;
+  char* obj = (char*)(s + 1) + (c->perslab - 1) * c->size;
+  for (; obj >= (char*)(s + 1); obj -= c->size)
+  {
+    ((struct slabobj*)obj)->next = s->free;
+    s->free                      = (struct slabobj*)obj;
+  }
+
+  s->prev = 0;
+  s->next = c->partial;
+  if (c->partial)
+  {
+    c->partial->prev = s;
+  }
+  c->partial = s;
+  ++c->nslab;
+  return s;
+}
+
+static void
+slabunlink(struct kmem_cache* c, struct slab* s)
+{
+  if (s->prev)
+  {
+    s->prev->next = s->next;
+  }
+  else
+  {
+    c->partial = s->next;
+  }
+  if (s->next)
+  {
+    s->next->prev = s->prev;
+  }
+}
+
+// slab에서 object를 최대 SLABBATCH개 꺼내 sc에 채운다
+static void
+slabrefill(struct kmem_cache* c, struct slabcpu* sc)
+{
+  acquire(&c->lock);
+  while (sc->n < SLABBATCH)
+  {
+    struct slab* s = c->partial;
+    if (!s && !(s = slabgrow(c)))
+    {
+      break;
+    }
+
+    struct slabobj* obj = s->free;
+    s->free             = obj->next;
+    ++s->inuse;
+    sc->obj[sc->n++] = obj;
+
+    // 다 쓴 slab은 partial list에서 뺀다
+    if (!s->free)
+    {
+      slabunlink(c, s);
+    }
+  }
+  release(&c->lock);
+}
+
+// sc의 object를 SLABBATCH개 slab으로 돌려보낸다
+// 비게 된 slab은 다른 partial slab이 있으면 page를 반납한다
+static void
+slabdrain(struct kmem_cache* c, struct slabcpu* sc)
+{
+  acquire(&c->lock);
+  for (int i = 0; i < SLABBATCH && sc->n > 0; ++i)
+  {
+    struct slabobj* obj = sc->obj[--sc->n];
+    struct slab* s      = (struct slab*)PGROUNDDOWN((uint)obj);
+    if (s->cache != c)
+    {
+      panic("kmem_cache_free: wrong cache");
+    }
+
+    if (!s->free)
+    {
+      s->prev = 0;
+      s->next = c->partial;
+      if (c->partial)
+      {
+        c->partial->prev = s;
+      }
+      c->partial = s;
+    }
+    obj->next = s->free;
+    s->free   = obj;
+
+    if (--s->inuse == 0 && (s->prev || s->next))
+    {
+      slabunlink(c, s);
+      --c->nslab;
+      kfree((char*)s);
+    }
+  }
+  release(&c->lock);
+}
+
+static struct slabcpu*
+lockslabcpu(struct kmem_cache* c)
+{
+  struct slabcpu* sc;
+
+  pushcli();
+  sc = &c->cpu[cpuid()];
+  acquire(&sc->lock);
+  popcli();
+  return sc;
+}
+
+// object를 하나 할당한다. 메모리가 없으면 0
+// object의 내용은 초기화되어 있지 않다
+void*
+kmem_cache_alloc(struct kmem_cache* c)
+{
+  void* obj = 0;
+
+  struct slabcpu* sc = lockslabcpu(c);
+  if (sc->n == 0)
+  {
+    slabrefill(c, sc);
+  }
+  if (sc->n > 0)
+  {
+    obj = sc->obj[--sc->n];
+  }
+  release(&sc->lock);
+  return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache* c, void* obj)
+{
+  struct slabcpu* sc = lockslabcpu(c);
+  if (sc->n == SLABMAG)
+  {
+    slabdrain(c, sc);
+  }
+  sc->obj[sc->n++] = obj;
+  release(&sc->lock);
+}
@@ -31,9 +31,10 @@ acquire(struct spinlock* lk)
     panic("acquire");
   }
 
-  // The xchg is atomic.
+  // The xchg is atomic. Answer TLB flush requests while spinning,
+  // since the holder may be waiting for this cpu in tlbflush().
   while (xchg(&lk->locked, 1) != 0)
-    ;
+    tlback();
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
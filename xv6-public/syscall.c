@@ -21,6 +21,8 @@ fetchint(uint addr, int* ip)
 
   if (addr >= curproc->sz || addr + 4 > curproc->sz)
     return -1;
+  if (prefault(addr, 4) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -40,6 +42,9 @@ fetchstr(uint addr, char** pp)
   ep  = (char*)curproc->sz;
   for (s = *pp; s < ep; s++)
   {
+    // Load pages of the executable before reading them.
+    if ((s == *pp || (uint)s % PGSIZE == 0) && prefault((uint)s, 1) < 0)
+      return -1;
     if (*s == 0)
       return s - *pp;
   }
@@ -66,6 +71,8 @@ argptr(int n, char** pp, int size)
     return -1;
   if (size < 0 || (uint)i >= curproc->sz || (uint)i + size > curproc->sz)
     return -1;
+  if (prefault(i, size) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
@@ -116,6 +123,13 @@ extern int sys_sync(void);
 extern int sys_get_log_num(void);
 extern int sys_pwrite(void);
 extern int sys_pread(void);
+extern int sys_sched_getparam(void);
+extern int sys_sched_setparam(void);
+extern int sys_sched_setaffinity(void);
+extern int sys_sched_getaffinity(void);
+extern int sys_sched_trace(void);
+extern int sys_kmemstat(void);
+extern int sys_thread_create_stack(void);
 
 static int (*syscalls[])(void) = { [SYS_fork] sys_fork,
                                    [SYS_exit] sys_exit,
@@ -149,7 +163,14 @@ static int (*syscalls[])(void) = { [SYS_fork] sys_fork,
                                    [SYS_sync] sys_sync,
                                    [SYS_get_log_num] sys_get_log_num,
                                    [SYS_pwrite] sys_pwrite,
-                                   [SYS_pread] sys_pread };
+                                   [SYS_pread] sys_pread,
+                                   [SYS_sched_getparam] sys_sched_getparam,
+                                   [SYS_sched_setparam] sys_sched_setparam,
+                                   [SYS_sched_setaffinity] sys_sched_setaffinity,
+                                   [SYS_sched_getaffinity] sys_sched_getaffinity,
+                                   [SYS_sched_trace] sys_sched_trace,
+                                   [SYS_kmemstat] sys_kmemstat,
+                                   [SYS_thread_create_stack] sys_thread_create_stack };
 
 void
 syscall(void)
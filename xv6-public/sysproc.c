@@ -7,6 +7,9 @@
 #include "mmu.h"
 #include "proc.h"
 #include "scheduler.h"
+#include "schedparam.h"
+#include "schedtrace.h"
+#include "kmemstat.h"
 
 int
 sys_fork(void)
@@ -73,6 +76,84 @@ sys_set_cpu_share(void)
   return set_cpu_share(myproc()->pgroup_master, usage);
 }
 
+int
+sys_sched_getparam(void)
+{
+  struct schedparam* param;
+
+  if (argptr(0, (char**)&param, sizeof(*param)) < 0)
+    return -1;
+
+  sched_getparam(param);
+  return 0;
+}
+
+int
+sys_sched_setparam(void)
+{
+  struct schedparam* param;
+  struct schedparam copy;
+
+  if (argptr(0, (char**)&param, sizeof(*param)) < 0)
+    return -1;
+
+  // 검사하는 동안 user가 값을 바꾸지 못하도록 복사해 둔다
+  copy = *param;
+  return sched_setparam(&copy);
+}
+
+int
+sys_sched_setaffinity(void)
+{
+  int pid;
+  int mask;
+
+  if (argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+
+  return setaffinity(pid, mask);
+}
+
+int
+sys_sched_getaffinity(void)
+{
+  int pid;
+
+  if (argint(0, &pid) < 0)
+    return -1;
+
+  return getaffinity(pid);
+}
+
+int
+sys_sched_trace(void)
+{
+  int cpu;
+  uint* seq;
+  struct traceevent* buf;
+  int n;
+
+  if (argint(0, &cpu) < 0 || argptr(1, (char**)&seq, sizeof(*seq)) < 0 ||
+      argint(3, &n) < 0 || n < 0 || n > NTRACE ||
+      argptr(2, (char**)&buf, n * sizeof(*buf)) < 0)
+    return -1;
+
+  return schedtraceread(cpu, seq, buf, n);
+}
+
+int
+sys_kmemstat(void)
+{
+  struct kmemstat* st;
+
+  if (argptr(0, (char**)&st, sizeof(*st)) < 0)
+    return -1;
+
+  kmemstat(st);
+  textstat(st);
+  return 0;
+}
+
 int
 sys_sbrk(void)
 {
@@ -147,7 +228,23 @@ sys_thread_create(void)
       argptr(2, (char**)&arg, sizeof(arg)) < 0)
     return -1;
 
-  return thread_create(thread, start_routine, arg);
+  return thread_create(thread, start_routine, arg, 0);
+}
+
+int
+sys_thread_create_stack(void)
+{
+  thread_t* thread;
+  void* (*start_routine)(void*);
+  void* arg;
+  int stacksize;
+
+  if (argptr(0, (char**)&thread, sizeof(thread)) < 0 ||
+      argptr(1, (char**)&start_routine, sizeof(start_routine)) < 0 ||
+      argptr(2, (char**)&arg, sizeof(arg)) < 0 || argint(3, &stacksize) < 0)
+    return -1;
+
+  return thread_create(thread, start_routine, arg, stacksize);
 }
 
 int
@@ -35,6 +35,27 @@ idtinit(void)
 }
 
 extern void pgroup_irq_trap(void);
+
+// Resolve a page fault that exec(), sbrk() or fork() left for
+// later. Returns -1 if the access was really invalid.
+static int
+pagefault(struct proc* p, uint va, uint err, int user)
+{
+  struct proc* pgmaster = p->pgroup_master;
+
+  if (!(err & FEC_P))
+  {
+    // Reading the executable sleeps, which the kernel must not do
+    // while holding a spinlock; system calls prefault() instead.
+    if (execseg(pgmaster, va))
+      return (user || mycpu()->ncli == 0) ? execfault(pgmaster, va) : -1;
+    return lazyfault(p->pgdir, va, pgmaster->sz);
+  }
+  if (err & FEC_WR)
+    return cowfault(p->pgdir, va);
+  return -1;
+}
+
 // PAGEBREAK: 41
 void
 trap(struct trapframe* tf)
@@ -53,7 +74,8 @@ trap(struct trapframe* tf)
   switch (tf->trapno)
   {
   case T_IRQ0 + IRQ_TIMER:
-    if (cpuid() == 0)
+    // Time slice deadlines also interrupt; only real ticks count.
+    if (lapictimer() && cpuid() == 0)
     {
       acquire(&tickslock);
       ticks++;
@@ -66,6 +88,10 @@ trap(struct trapframe* tf)
     ideintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_WAKEUP:
+    // Only needs to wake an idle cpu out of hlt.
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE + 1:
     // Bochs generates spurious IDE1 interrupts.
     break;
@@ -83,6 +109,21 @@ trap(struct trapframe* tf)
     lapiceoi();
     break;
 
+  case T_IRQ0 + IRQ_TLB:
+    // Another cpu changed a page table this cpu may be using.
+    tlback();
+    lapiceoi();
+    break;
+  case T_PGFLT:
+    // The first touch of a page of the executable or of the heap
+    // grown by sbrk(), or a write to a copy-on-write page. Any of
+    // them may come from user space or from the kernel accessing
+    // user memory.
+    if (myproc() &&
+        pagefault(myproc(), rcr2(), tf->err, (tf->cs & 3) == DPL_USER) == 0)
+      break;
+    // fall through
+
   // PAGEBREAK: 13
   default:
     if (myproc() == 0 || (tf->cs & 3) == 0)
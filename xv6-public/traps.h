@@ -34,4 +34,6 @@
 #define IRQ_COM1     4
 #define IRQ_IDE      14
 #define IRQ_ERROR    19
+#define IRQ_WAKEUP   20 // IPI: wake an idle cpu
+#define IRQ_TLB      21 // IPI: flush the TLB
 #define IRQ_SPURIOUS 31
@@ -3,6 +3,9 @@
 
 struct stat;
 struct rtcdate;
+struct schedparam;
+struct traceevent;
+struct kmemstat;
 
 // system calls
 int fork(void);
@@ -31,6 +34,7 @@ void yield(void);
 int set_cpu_share(int);
 int getlev(void);
 int thread_create(thread_t*, void* (*)(void*), void*);
+int thread_create_stack(thread_t*, void* (*)(void*), void*, uint);
 void thread_exit(void*);
 int thread_join(thread_t, void**);
 int ps();
@@ -38,6 +42,12 @@ int sync();
 int get_log_num();
 int pwrite(int, const void*, int, int);
 int pread(int, void*, int, int);
+int sched_getparam(struct schedparam*);
+int sched_setparam(struct schedparam*);
+int sched_setaffinity(int, uint);
+int sched_getaffinity(int);
+int sched_trace(int, uint*, struct traceevent*, int);
+int kmemstat(struct kmemstat*);
 
 // ulib.c
 int stat(const char*, struct stat*);
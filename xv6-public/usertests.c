@@ -7,6 +7,7 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "kmemstat.h"
 
 char buf[8192];
 char name[3];
@@ -1662,6 +1663,526 @@ forktest(void)
   printf(1, "fork test OK\n");
 }
 
+// exit() carries no status, so a child started with forkcheck()
+// reports whether its checks passed with childdone(), and the parent
+// gets the result from childok().
+int checkfds[2];
+
+int
+forkcheck(void)
+{
+  int pid;
+
+  if (pipe(checkfds) != 0)
+  {
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if (pid < 0)
+  {
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if (pid > 0)
+    close(checkfds[1]);
+  return pid;
+}
+
+void
+childdone(int ok)
+{
+  write(checkfds[1], ok ? "y" : "n", 1);
+  exit();
+}
+
+// Wait for the child; a child that died without reporting failed.
+int
+childok(void)
+{
+  char c;
+  int ok;
+
+  wait();
+  ok = read(checkfds[0], &c, 1) == 1 && c == 'y';
+  close(checkfds[0]);
+  return ok;
+}
+
+// fork() shares pages copy-on-write. Writes by the child, including
+// the ones the kernel makes for read(), must not reach the parent.
+void
+cowtest(void)
+{
+  static char buf[3 * 4096];
+  int fds[2], i;
+
+  printf(1, "cow test\n");
+
+  memset(buf, 'p', sizeof(buf));
+  if (pipe(fds) != 0)
+  {
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  if (forkcheck() == 0)
+  {
+    buf[0] = 'c';
+    write(fds[1], "c", 1);
+    childdone(read(fds[0], buf + 4096, 1) == 1 && buf[0] == 'c' &&
+              buf[4096] == 'c' && buf[1] == 'p');
+  }
+  if (!childok())
+  {
+    printf(1, "cow: child lost a write\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  for (i = 0; i < sizeof(buf); i++)
+  {
+    if (buf[i] != 'p')
+    {
+      printf(1, "cow: child write reached parent at %d\n", i);
+      exit();
+    }
+  }
+  // The parent now holds the only reference to these pages.
+  buf[2 * 4096] = 'x';
+
+  printf(1, "cow test OK\n");
+}
+
+// sbrk() only reserves address space; pages appear zeroed on first
+// touch, also when the kernel touches them first or after a fork().
+void
+lazysbrktest(void)
+{
+  int fds[2];
+  char *a, *oldbrk;
+
+  printf(1, "lazy sbrk test\n");
+
+  oldbrk = sbrk(0);
+  a      = sbrk(10 * 4096);
+  if (a == (char*)0xffffffff)
+  {
+    printf(1, "lazy sbrk: sbrk failed\n");
+    exit();
+  }
+  if (pipe(fds) != 0)
+  {
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  write(fds[1], "z", 1);
+  if (read(fds[0], a + 3 * 4096, 1) != 1 || a[3 * 4096] != 'z' ||
+      a[3 * 4096 + 1] != 0)
+  {
+    printf(1, "lazy sbrk: read into untouched page failed\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  if (forkcheck() == 0)
+  {
+    int ok      = a[9 * 4096] == 0 && a[3 * 4096] == 'z';
+    a[9 * 4096] = 1;
+    childdone(ok);
+  }
+  if (!childok())
+  {
+    printf(1, "lazy sbrk: child sees wrong data\n");
+    exit();
+  }
+  if (a[9 * 4096] != 0)
+  {
+    printf(1, "lazy sbrk: child write reached parent\n");
+    exit();
+  }
+
+  sbrk(-(sbrk(0) - oldbrk));
+  printf(1, "lazy sbrk test OK\n");
+}
+
+// use about 3000 bytes of stack per level
+int
+stackdepth(int n)
+{
+  char buf[3000];
+
+  memset(buf, n, sizeof(buf));
+  if (n > 1)
+    return buf[0] + stackdepth(n - 1);
+  return buf[0];
+}
+
+void*
+stackthread(void* arg)
+{
+  int pages = (int)arg;
+
+  thread_exit((void*)stackdepth(pages));
+  return 0;
+}
+
+#define NSTACKTHREAD 6
+
+// threads with different stack sizes must reuse freed stacks
+// instead of growing the process forever.
+void
+threadstacktest(void)
+{
+  static int sizes[NSTACKTHREAD] = { 1, 3, 2, 5, 1, 4 };
+  thread_t t[NSTACKTHREAD];
+  void* ret;
+  char* oldbrk;
+  int round, i;
+
+  printf(1, "thread stack test\n");
+  if (forkcheck() == 0)
+  {
+    oldbrk = sbrk(0);
+    for (round = 0; round < 50; round++)
+    {
+      for (i = 0; i < NSTACKTHREAD; i++)
+      {
+        if (thread_create_stack(&t[i], stackthread,
+                                (void*)sizes[(i + round) % NSTACKTHREAD],
+                                sizes[(i + round) % NSTACKTHREAD] * 4096) != 0)
+        {
+          printf(1, "thread_create_stack failed\n");
+          childdone(0);
+        }
+      }
+      // join in an order that leaves holes to be merged
+      for (i = round % 2; i < NSTACKTHREAD; i += 2)
+        thread_join(t[i], &ret);
+      for (i = 1 - round % 2; i < NSTACKTHREAD; i += 2)
+        thread_join(t[i], &ret);
+    }
+    if (sbrk(0) - oldbrk >= 4096)
+    {
+      printf(1, "thread stack: sz grew by %d\n", sbrk(0) - oldbrk);
+      childdone(0);
+    }
+    childdone(1);
+  }
+  if (!childok())
+  {
+    printf(1, "thread stack test failed\n");
+    exit();
+  }
+  printf(1, "thread stack test OK\n");
+}
+
+// Number of free physical pages, counting the per-cpu caches and
+// the zeroed pool.
+uint
+freepages(void)
+{
+  struct kmemstat st;
+  uint n;
+  int o;
+
+  if (kmemstat(&st) < 0)
+  {
+    printf(1, "kmemstat failed\n");
+    exit();
+  }
+  n = st.cached + st.zeroed;
+  for (o = 0; o < MAXORDER; o++)
+    n += st.nfree[o] << o;
+  return n;
+}
+
+#define NSTACKROUND 1000
+
+// Creating and joining threads must give back every page it took:
+// stacks, kernel stacks and page table pages.
+void
+threadleaktest(void)
+{
+  static int sizes[NSTACKTHREAD] = { 1, 3, 2, 5, 1, 4 };
+  thread_t t[NSTACKTHREAD];
+  void* ret;
+  uint before, after;
+  int round, i;
+
+  printf(1, "thread leak test\n");
+  if (forkcheck() == 0)
+  {
+    // Round 0 fills the stack bin, so later rounds should not need
+    // any new pages.
+    before = 0;
+    for (round = 0; round <= NSTACKROUND; round++)
+    {
+      if (round == 1)
+        before = freepages();
+      for (i = 0; i < NSTACKTHREAD; i++)
+      {
+        if (thread_create_stack(&t[i], stackthread,
+                                (void*)sizes[(i + round) % NSTACKTHREAD],
+                                sizes[(i + round) % NSTACKTHREAD] * 4096) != 0)
+        {
+          printf(1, "thread_create_stack failed\n");
+          childdone(0);
+        }
+      }
+      for (i = 0; i < NSTACKTHREAD; i++)
+        thread_join(t[i], &ret);
+    }
+    after = freepages();
+    // Leave some room for pages other processes took meanwhile.
+    if (after + 16 < before)
+    {
+      printf(1, "thread leak: free pages %d -> %d\n", before, after);
+      childdone(0);
+    }
+    childdone(1);
+  }
+  if (!childok())
+  {
+    printf(1, "thread leak test failed\n");
+    exit();
+  }
+  printf(1, "thread leak test OK\n");
+}
+
+#define NFORKROUND 200
+
+// Many processes forking and exiting at once on all cpus; afterwards
+// no page may be left behind in a per-cpu cache or anywhere else.
+void
+forkstresstest(void)
+{
+  uint before, after;
+  int i, j, pid;
+
+  printf(1, "fork stress test\n");
+  before = freepages();
+  for (i = 0; i < NCPU; i++)
+  {
+    if ((pid = fork()) < 0)
+    {
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if (pid == 0)
+    {
+      for (j = 0; j < NFORKROUND; j++)
+      {
+        if ((pid = fork()) < 0)
+        {
+          printf(1, "fork failed\n");
+          exit();
+        }
+        if (pid == 0)
+          exit();
+        wait();
+      }
+      exit();
+    }
+  }
+  for (i = 0; i < NCPU; i++)
+    wait();
+  after = freepages();
+  if (after + 16 < before)
+  {
+    printf(1, "fork stress: free pages %d -> %d\n", before, after);
+    exit();
+  }
+  printf(1, "fork stress test OK\n");
+}
+
+#define FRAGPAGES 4096
+
+// Touching many sbrk pages splits the largest free blocks into single
+// pages; once they are freed again the buddies must merge back.
+void
+buddytest(void)
+{
+  struct kmemstat before, after;
+  char* a;
+  int i, big;
+
+  printf(1, "buddy test\n");
+  if (kmemstat(&before) < 0)
+  {
+    printf(1, "kmemstat failed\n");
+    exit();
+  }
+  if (forkcheck() == 0)
+  {
+    // Grow and shrink in steps so that pages are handed out and
+    // given back in a mixed order.
+    for (i = 0; i < 4; i++)
+    {
+      a = sbrk(FRAGPAGES / 2 * 4096);
+      if (a == (char*)0xffffffff)
+      {
+        printf(1, "buddy: sbrk failed\n");
+        childdone(0);
+      }
+      for (; a < sbrk(0); a += 4096)
+        *a = 1;
+      sbrk(-(FRAGPAGES / 4 * 4096));
+    }
+    childdone(1);
+  }
+  if (!childok())
+  {
+    printf(1, "buddy test failed\n");
+    exit();
+  }
+  if (kmemstat(&after) < 0)
+  {
+    printf(1, "kmemstat failed\n");
+    exit();
+  }
+  // A few pages may still sit in the per-cpu caches and keep their
+  // blocks from merging.
+  big = MAXORDER - 1;
+  if (after.nfree[big] + 4 < before.nfree[big])
+  {
+    printf(1, "buddy: order %d blocks %d -> %d\n", big, before.nfree[big],
+           after.nfree[big]);
+    exit();
+  }
+  printf(1, "buddy test OK\n");
+}
+
+#define ZEROPAGES 256
+
+// Return 1 if the n pages at a are all zero.
+int
+pageszero(char* a, int n)
+{
+  int i;
+
+  for (i = 0; i < n * 4096; i++)
+    if (a[i] != 0)
+      return 0;
+  return 1;
+}
+
+// Fresh sbrk memory must read as zero, whether its pages come from
+// the pool an idle cpu cleared in advance or are cleared on demand.
+void
+zerotest(void)
+{
+  struct kmemstat st;
+  int pids[NCPU];
+  char* a;
+  int i, n, dry;
+
+  printf(1, "zero test\n");
+
+  // Recycle pages full of junk.
+  for (i = 0; i < 20; i++)
+  {
+    a = sbrk(ZEROPAGES * 4096);
+    if (a == (char*)0xffffffff)
+    {
+      printf(1, "zero: sbrk failed\n");
+      exit();
+    }
+    if (!pageszero(a, ZEROPAGES))
+    {
+      printf(1, "zero: round %d memory not zero\n", i);
+      exit();
+    }
+    memset(a, 0xa5, ZEROPAGES * 4096);
+    sbrk(-(ZEROPAGES * 4096));
+  }
+
+  // Keep every cpu busy so that nobody refills the pool, then use
+  // it up.
+  for (i = 0; i < NCPU; i++)
+  {
+    if ((pids[i] = fork()) < 0)
+    {
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if (pids[i] == 0)
+      for (;;)
+        ;
+  }
+  a   = sbrk(ZEROPAGES * 4096);
+  dry = 0;
+  for (i = 0; i < ZEROPAGES && pageszero(a + i * 4096, 1); i++)
+    if (kmemstat(&st) == 0 && st.zeroed == 0)
+      dry = 1;
+  for (n = 0; n < NCPU; n++)
+  {
+    kill(pids[n]);
+    wait();
+  }
+  sbrk(-(ZEROPAGES * 4096));
+  if (i < ZEROPAGES)
+  {
+    printf(1, "zero: page %d not zero (pool %s)\n", i,
+           dry ? "empty" : "not empty");
+    exit();
+  }
+  if (!dry)
+  {
+    printf(1, "zero: pool of zeroed pages never ran dry\n");
+    exit();
+  }
+  printf(1, "zero test OK\n");
+}
+
+// The pages of an executable stay in the text cache after the last
+// process running it exits, so the next exec of the file reuses them.
+void
+textcachetest(void)
+{
+  struct kmemstat before, after;
+  char* args[] = { "echo", 0 };
+  int i, pid;
+
+  printf(1, "text cache test\n");
+  for (i = 0; i < 2; i++)
+  {
+    // The first run fills the cache, the second should hit it.
+    if (i == 1 && kmemstat(&before) < 0)
+    {
+      printf(1, "kmemstat failed\n");
+      exit();
+    }
+    pid = fork();
+    if (pid < 0)
+    {
+      printf(1, "fork failed\n");
+      exit();
+    }
+    if (pid == 0)
+    {
+      close(1);
+      exec("echo", args);
+      printf(2, "text cache: exec echo failed\n");
+      exit();
+    }
+    wait();
+  }
+  if (kmemstat(&after) < 0)
+  {
+    printf(1, "kmemstat failed\n");
+    exit();
+  }
+  if (after.texthit == before.texthit)
+  {
+    printf(1, "text cache: second exec missed (miss %d -> %d)\n",
+           before.textmiss, after.textmiss);
+    exit();
+  }
+  printf(1, "text cache test OK\n");
+}
+
 void
 sbrktest(void)
 {
@@ -2038,6 +2559,99 @@ rand()
   return randstate;
 }
 
+#define LARGEFILE (4096 * 512)
+
+// Byte at offset off of the large file; differs between blocks.
+char
+largebyte(int off)
+{
+  return off + off / 512 * 7;
+}
+
+// Write a file that reaches the doubly indirect blocks and read it
+// back, once from start to end and once at random offsets, so that
+// read-ahead and the disk request queue see both patterns.
+void
+largefiletest(void)
+{
+  int fd, off, i, j, n;
+
+  printf(1, "large file test\n");
+
+  unlink("largefile");
+  fd = open("largefile", O_CREATE | O_RDWR);
+  if (fd < 0)
+  {
+    printf(1, "cannot create largefile\n");
+    exit();
+  }
+  for (off = 0; off < LARGEFILE; off += sizeof(buf))
+  {
+    for (i = 0; i < sizeof(buf); i++)
+      buf[i] = largebyte(off + i);
+    if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+    {
+      printf(1, "write largefile failed at %d\n", off);
+      exit();
+    }
+  }
+  close(fd);
+
+  fd = open("largefile", 0);
+  if (fd < 0)
+  {
+    printf(1, "cannot open largefile\n");
+    exit();
+  }
+  for (off = 0; off < LARGEFILE; off += n)
+  {
+    n = read(fd, buf, sizeof(buf));
+    if (n <= 0)
+    {
+      printf(1, "read largefile failed at %d\n", off);
+      exit();
+    }
+    for (i = 0; i < n; i++)
+    {
+      if (buf[i] != largebyte(off + i))
+      {
+        printf(1, "largefile: wrong data at %d\n", off + i);
+        exit();
+      }
+    }
+  }
+  if (read(fd, buf, 1) != 0)
+  {
+    printf(1, "largefile: too long\n");
+    exit();
+  }
+
+  for (j = 0; j < 200; j++)
+  {
+    off = rand() % LARGEFILE;
+    n   = rand() % sizeof(buf) + 1;
+    if (off + n > LARGEFILE)
+      n = LARGEFILE - off;
+    if (pread(fd, buf, n, off) != n)
+    {
+      printf(1, "pread largefile failed at %d\n", off);
+      exit();
+    }
+    for (i = 0; i < n; i++)
+    {
+      if (buf[i] != largebyte(off + i))
+      {
+        printf(1, "largefile: wrong data at %d\n", off + i);
+        exit();
+      }
+    }
+  }
+  close(fd);
+  unlink("largefile");
+
+  printf(1, "large file test ok\n");
+}
+
 int
 main(int argc, char* argv[])
 {
@@ -2081,12 +2695,21 @@ main(int argc, char* argv[])
   rmdot();
   fourteen();
   bigfile();
+  largefiletest();
   subdir();
   linktest();
   unlinkread();
   dirfile();
   iref();
   forktest();
+  cowtest();
+  lazysbrktest();
+  threadstacktest();
+  threadleaktest();
+  forkstresstest();
+  buddytest();
+  zerotest();
+  textcachetest();
   bigdir(); // slow
 
   uio();
@@ -6,10 +6,48 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "kmemstat.h"
 
 extern char data[]; // defined by kernel.ld
 pde_t* kpgdir;      // for use in scheduler()
 
+// Serializes changes to copy-on-write PTEs and page references,
+// since LWPs sharing a page table can fault on the same page.
+struct spinlock cowlock;
+
+static void tlbflush(pde_t* pgdir);
+
+// Pages read from executables, shared copy-on-write by every process
+// running the same binary, also one after another. An entry holds one
+// reference to its page and is named by the file bytes that were read
+// into it; the rest of the page is zero. The file is named by a
+// generation that textload() gives the inode and textinval() takes
+// away when the contents change, so stale entries are never found
+// and just age out.
+struct textpage
+{
+  uint gen;  // ip->textgen of the file
+  uint off;  // file offset of the page
+  uint n;    // bytes read from the file
+  char* mem; // 0 if the entry is unused
+  uint used; // textcache.clock at the last lookup
+};
+
+struct
+{
+  struct spinlock lock;
+  struct textpage page[NTEXTPAGE];
+  uint clock;
+  uint gen; // last generation given to an inode
+  uint hit;
+  uint miss;
+} textcache;
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -45,10 +83,9 @@ walkpgdir(pde_t* pgdir, const void* va, int alloc)
   }
   else
   {
-    if (!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if (!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -126,9 +163,8 @@ setupkvm(void)
   pde_t* pgdir;
   struct kmap* k;
 
-  if ((pgdir = (pde_t*)kalloc()) == 0)
+  if ((pgdir = (pde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for (k = kmap; k < &kmap[NELEM(kmap)]; k++)
@@ -146,6 +182,8 @@ setupkvm(void)
 void
 kvmalloc(void)
 {
+  initlock(&cowlock, "cow");
+  initlock(&textcache.lock, "textcache");
   kpgdir = setupkvm();
   switchkvm();
 }
@@ -192,8 +230,7 @@ inituvm(pde_t* pgdir, char* init, uint sz)
 
   if (sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W | PTE_U);
   memmove(mem, init, sz);
 }
@@ -223,77 +260,209 @@ loaduvm(pde_t* pgdir, char* addr, struct inode* ip, uint offset, uint sz)
   return 0;
 }
 
-static const uint stackbin_magic = 0x1234abcd;
-
-struct stackbin_header
+// stackbin: thread stack으로 쓰다 반납된 주소 범위들
+// 범위의 정보는 kernel의 slab object에 두고, user page에는 아무것도
+// 쓰지 않는다 (user가 고칠 수 없고 fork로 복사할 필요도 없다)
+// bin에 있는 범위의 page는 모두 해제되어 있다
+// 범위는 주소 순서의 list와 크기 class별 list에 동시에 들어 있다
+// class k에는 2^k 이상 2^(k+1) 미만 page의 범위가 있다 (마지막 class는
+// 그 이상 전부)
+struct stackrange
 {
-  uint magic;
-  uint pagecnt;
-  uint sz;
-  struct linked_list list;
+  uint start;  // 첫 page의 주소
+  uint npages;
+  struct linked_list addr; // stackbin.byaddr
+  struct linked_list size; // stackbin.bysize[stackclass(npages)]
 };
 
-int
-allocpageuvm(pde_t* pgdir, struct linked_list* head, uint sz, uint pagecnt)
+static struct kmem_cache* stackcache;
+
+void
+stackbininit(void)
+{
+  stackcache = kmem_cache_create("stackbin", sizeof(struct stackrange));
+}
+
+void
+initstackbin(struct stackbin* bin)
 {
-  if (linked_list_is_empty(head))
+  linked_list_init(&bin->byaddr);
+  for (int i = 0; i < NSTACKCLASS; ++i)
   {
-    return allocuvm(pgdir, sz, sz + pagecnt * PGSIZE);
+    linked_list_init(&bin->bysize[i]);
   }
+}
 
-  struct stackbin_header* header = 0;
-  for (struct linked_list* pos = head->next; pos != head; pos = pos->next)
+static int
+stackclass(uint npages)
+{
+  int c = 0;
+  while (c < NSTACKCLASS - 1 && (npages >> (c + 1)))
   {
-    header = container_of(pos, struct stackbin_header, list);
-    if (header->magic != stackbin_magic)
-    {
-      panic("stackbin corrupted");
-    }
-    
-    if (header->pagecnt >= pagecnt)
-    {
-      break;
-    }
+    ++c;
   }
-  
-  // cprintf("free (%p, %d, %d)\n", header, header->sz, header->pagecnt);
+  return c;
+}
+
+static uint
+stackend(struct stackrange* r)
+{
+  return r->start + r->npages * PGSIZE;
+}
+
+// 크기가 바뀐 범위를 맞는 class로 옮긴다
+static void
+stackrefile(struct stackbin* bin, struct stackrange* r)
+{
+  linked_list_remove(&r->size);
+  linked_list_init(&r->size);
+  linked_list_push_back(&r->size, &bin->bysize[stackclass(r->npages)]);
+}
+
+static void
+stackremove(struct stackrange* r)
+{
+  linked_list_remove(&r->addr);
+  linked_list_remove(&r->size);
+  kmem_cache_free(stackcache, r);
+}
 
-  // TODO: merge 구현
-  if (!header)
+// bin의 범위를 모두 버린다. page는 pgdir과 함께 해제된다
+void
+freestackbin(struct stackbin* bin)
+{
+  while (!linked_list_is_empty(&bin->byaddr))
   {
-    panic("not supported: merge stackbin");
+    stackremove(container_of(bin->byaddr.next, struct stackrange, addr));
   }
+}
 
-  // TODO: split 구현
-  if (header->pagecnt != pagecnt)
+// bin에서 pagecnt page 이상인 범위를 찾는다. 없으면 0
+static struct stackrange*
+stackfit(struct stackbin* bin, uint sz, uint pagecnt)
+{
+  for (int c = stackclass(pagecnt); c < NSTACKCLASS; ++c)
   {
-    panic("not supported: split stackbin");
+    for (struct linked_list *pos = bin->bysize[c].next, *next = pos->next;
+         pos != &bin->bysize[c]; pos = next, next = pos->next)
+    {
+      struct stackrange* r = container_of(pos, struct stackrange, size);
+
+      // sbrk로 줄어든 영역에 남은 범위는 버린다
+      if (stackend(r) > PGROUNDUP(sz))
+      {
+        stackremove(r);
+        continue;
+      }
+      if (r->npages >= pagecnt)
+      {
+        return r;
+      }
+    }
   }
+  return 0;
+}
 
-  linked_list_remove(&header->list);
+// pagecnt page의 stack 영역을 할당하고 그 끝 주소를 반환한다
+// bin에서 맞는 범위를 찾아 필요한 만큼 잘라 쓰고, 없으면 sz 위에
+// 새로 잡는다. 실패하면 0
+int
+allocpageuvm(pde_t* pgdir, struct stackbin* bin, uint sz, uint pagecnt)
+{
+  struct stackrange* r = stackfit(bin, sz, pagecnt);
+  uint start           = r ? r->start : PGROUNDUP(sz);
+  uint top             = start + pagecnt * PGSIZE;
 
-  int result = header->sz;
+  if (top < start || top >= KERNBASE)
+  {
+    return 0;
+  }
 
-  // stackbin 헤더를 지움 (취약점 방지)
-  memset(header, 0, sizeof(header));
+  // stack page는 처음 쓸 때 lazyfault()가 할당한다
+  // clearpteu()가 고칠 guard page와 clone()이 인자를 적을 맨 위 page만
+  // 미리 할당한다
+  if (lazyfault(pgdir, start, top) < 0 ||
+      lazyfault(pgdir, top - PGSIZE, top) < 0)
+  {
+    deallocuvm(pgdir, top, start);
+    return 0;
+  }
 
-  return result;
+  // 앞부분을 떼어 쓰고 나머지는 bin에 남긴다
+  if (r && r->npages == pagecnt)
+  {
+    stackremove(r);
+  }
+  else if (r)
+  {
+    r->start += pagecnt * PGSIZE;
+    r->npages -= pagecnt;
+    stackrefile(bin, r);
+  }
+  return top;
 }
 
+// end 주소가 top인 pagecnt page의 stack 영역의 page를 해제하고 범위를
+// bin에 반납한 뒤 새 sz를 반환한다. 주소가 이어지는 범위끼리는 합치고,
+// 합친 범위가 sz 끝에 닿으면 sz를 줄인다
 int
-freepageuvm(pde_t* pgdir, struct linked_list* head, uint sz, uint pagecnt)
-{
-  uint a = PGROUNDUP(sz);
-  pte_t* pte = walkpgdir(pgdir, (char*)a, 0);
-  
-  struct stackbin_header* header = P2V(PTE_ADDR(*pte));
-  header->magic = stackbin_magic;
-  header->pagecnt = pagecnt;
-  header->sz = sz;
-  linked_list_init(&header->list);
-  linked_list_push_back(&header->list, head);
+freepageuvm(pde_t* pgdir, struct stackbin* bin, uint sz, uint top,
+            uint pagecnt)
+{
+  struct stackrange *prev = 0, *next = 0, *r;
+  uint start = top - pagecnt * PGSIZE;
+  struct linked_list* pos;
 
-  return 0;
+  // join된 thread의 stack이므로 다른 LWP의 TLB에서 지워진 뒤에 해제한다
+  shrinkuvm(pgdir, top, start);
+
+  // 주소 순서에서 들어갈 자리를 찾는다
+  for (pos = bin->byaddr.next; pos != &bin->byaddr; pos = pos->next)
+  {
+    r = container_of(pos, struct stackrange, addr);
+    if (r->start > start)
+    {
+      next = r;
+      break;
+    }
+    prev = r;
+  }
+
+  if (prev && stackend(prev) == start)
+  {
+    r = prev;
+    r->npages += pagecnt;
+  }
+  else
+  {
+    // object를 할당하지 못하면 이 영역은 재사용하지 못할 뿐이다
+    if ((r = kmem_cache_alloc(stackcache)) == 0)
+    {
+      return sz;
+    }
+    r->start  = start;
+    r->npages = pagecnt;
+    linked_list_init(&r->addr);
+    linked_list_init(&r->size);
+    linked_list_insert(&r->addr, next ? next->addr.prev : bin->byaddr.prev,
+                       next ? &next->addr : &bin->byaddr);
+    linked_list_push_back(&r->size, &bin->bysize[stackclass(pagecnt)]);
+  }
+
+  if (next && stackend(r) == next->start)
+  {
+    r->npages += next->npages;
+    stackremove(next);
+  }
+
+  if (stackend(r) == PGROUNDUP(sz))
+  {
+    sz = r->start;
+    stackremove(r);
+    return sz;
+  }
+  stackrefile(bin, r);
+  return sz;
 }
 
 // Allocate page tables and physical memory to grow process from oldsz to
@@ -312,14 +481,13 @@ allocuvm(pde_t* pgdir, uint oldsz, uint newsz)
   a = PGROUNDUP(oldsz);
   for (; a < newsz; a += PGSIZE)
   {
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if (mem == 0)
     {
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if (mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W | PTE_U) < 0)
     {
       cprintf("allocuvm out of memory (2)\n");
@@ -363,6 +531,41 @@ deallocuvm(pde_t* pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Unmap the user pages of [newsz, oldsz) like deallocuvm(), but free
+// them only after every cpu sharing pgdir has flushed its TLB, so that
+// an LWP running elsewhere cannot write into a page already handed
+// out again. Pages are collected UNMAPBATCH at a time.
+void
+shrinkuvm(pde_t* pgdir, uint oldsz, uint newsz)
+{
+  char* pages[UNMAPBATCH];
+  pte_t* pte;
+  uint a;
+  int i, n;
+
+  a = PGROUNDUP(newsz);
+  while (a < oldsz)
+  {
+    n = 0;
+    acquire(&cowlock);
+    for (; a < oldsz && n < UNMAPBATCH; a += PGSIZE)
+    {
+      pte = walkpgdir(pgdir, (char*)a, 0);
+      if (!pte)
+        a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      else if ((*pte & PTE_P) != 0)
+      {
+        pages[n++] = P2V(PTE_ADDR(*pte));
+        *pte       = 0;
+      }
+    }
+    release(&cowlock);
+    tlbflush(pgdir);
+    for (i = 0; i < n; i++)
+      kfree(pages[i]);
+  }
+}
+
 // Free a page table and all the physical memory pages
 // in the user part.
 void
@@ -408,42 +611,381 @@ setpteu(pde_t* pgdir, char* uva)
   *pte |= PTE_U;
 }
 
+// Flush this cpu's TLB if another cpu asked for it in tlbflush()
+// since the last flush, and acknowledge the requests seen so far.
+// Called with interrupts disabled.
+void
+tlback(void)
+{
+  struct cpu* c = mycpu();
+  uint req      = c->tlbreq;
+
+  if (req != c->tlbdone)
+  {
+    lcr3(rcr3());
+    c->tlbdone = req;
+  }
+}
+
+// Flush stale TLB entries for pgdir on this cpu and on every
+// other cpu running an LWP that shares it, and wait until all of
+// them have flushed, so that the caller may free pages unmapped
+// from pgdir. The cpus waiting here or spinning in acquire() answer
+// requests meanwhile, so the caller may hold spinlocks.
+static void
+tlbflush(pde_t* pgdir)
+{
+  struct cpu* c;
+  struct proc* p;
+  uint want[NCPU];
+  uint sent = 0;
+
+  pushcli();
+  if (rcr3() == V2P(pgdir))
+    lcr3(V2P(pgdir));
+  // Order the caller's PTE stores before the loads of c->proc.
+  __sync_synchronize();
+  for (c = cpus; c < cpus + ncpu; c++)
+  {
+    p = c->proc;
+    if (c != mycpu() && p && p->pgdir == pgdir)
+    {
+      want[c - cpus] = __sync_add_and_fetch(&c->tlbreq, 1);
+      sent |= 1 << (c - cpus);
+      lapicipi(c->apicid, T_IRQ0 + IRQ_TLB);
+    }
+  }
+  for (c = cpus; c < cpus + ncpu; c++)
+  {
+    if (!(sent & (1 << (c - cpus))))
+      continue;
+    while ((int)(c->tlbdone - want[c - cpus]) < 0)
+      tlback();
+  }
+  popcli();
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. Writable pages are shared read-only
+// with PTE_COW set and copied by cowfault() on the first write.
 pde_t*
 copyuvm(pde_t* pgdir, uint sz)
 {
   pde_t* d;
   pte_t* pte;
   uint pa, i, flags;
-  char* mem;
 
   if ((d = setupkvm()) == 0)
     return 0;
+  acquire(&cowlock);
   for (i = 0; i < sz; i += PGSIZE)
   {
+    // Heap pages not touched yet are left for lazyfault() in
+    // the child as well.
     if ((pte = walkpgdir(pgdir, (void*)i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+    {
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     if (!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa    = PTE_ADDR(*pte);
+      continue;
+    pa = PTE_ADDR(*pte);
+    if (*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     flags = PTE_FLAGS(*pte);
-    if ((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if (mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0)
-    {
-      kfree(mem);
+    if (mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
       goto bad;
-    }
+    kref(P2V(pa));
   }
+  release(&cowlock);
+  tlbflush(pgdir);
   return d;
 
 bad:
+  release(&cowlock);
+  tlbflush(pgdir);
   freevm(d);
   return 0;
 }
 
+// Map a zeroed page at va if it lies below sz but has not been
+// touched yet; sbrk() only grows the size (lazy allocation).
+// Returns -1 if va is not such a page or memory is exhausted.
+int
+lazyfault(pde_t* pgdir, uint va, uint sz)
+{
+  pte_t* pte;
+  char* mem;
+
+  if (va >= sz || va >= KERNBASE)
+    return -1;
+
+  va = PGROUNDDOWN(va);
+  acquire(&cowlock);
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  if (pte && (*pte & PTE_P))
+  {
+    // Another LWP mapped it first.
+    release(&cowlock);
+    return 0;
+  }
+  if ((mem = kalloc_zeroed()) == 0)
+  {
+    release(&cowlock);
+    return -1;
+  }
+  if (mappages(pgdir, (char*)va, PGSIZE, V2P(mem), PTE_W | PTE_U) < 0)
+  {
+    kfree(mem);
+    release(&cowlock);
+    return -1;
+  }
+  release(&cowlock);
+  return 0;
+}
+
+// Return the segment of p's executable that holds va, or 0.
+// p is a pgroup master.
+struct execseg*
+execseg(struct proc* p, uint va)
+{
+  struct execseg* seg;
+
+  if (p->execip == 0 || va >= p->sz)
+    return 0;
+  for (seg = p->execseg; seg < &p->execseg[p->nexecseg]; seg++)
+    if (va >= seg->vaddr && va < seg->vaddr + seg->memsz)
+      return seg;
+  return 0;
+}
+
+// Return a page holding n bytes of ip at off followed by zeros,
+// with a reference for the caller. The page is taken from the text
+// cache, or read and added to it. Caller holds ip->lock, which keeps
+// writei() and itrunc() from invalidating the entry meanwhile.
+static char*
+textload(struct inode* ip, uint off, uint n)
+{
+  struct textpage *t, *victim;
+  char *mem, *old;
+
+  acquire(&textcache.lock);
+  if (!ip->text)
+  {
+    ip->text    = 1;
+    ip->textgen = ++textcache.gen;
+  }
+  victim = textcache.page;
+  for (t = textcache.page; t < &textcache.page[NTEXTPAGE]; t++)
+  {
+    if (t->mem && t->gen == ip->textgen && t->off == off && t->n == n)
+    {
+      t->used = ++textcache.clock;
+      textcache.hit++;
+      kref(t->mem);
+      release(&textcache.lock);
+      return t->mem;
+    }
+    if (victim->mem && (t->mem == 0 || t->used < victim->used))
+      victim = t;
+  }
+  textcache.miss++;
+  release(&textcache.lock);
+
+  if ((mem = kalloc_zeroed()) == 0)
+    return 0;
+  if (readi(ip, mem, off, n) != n)
+  {
+    kfree(mem);
+    return 0;
+  }
+
+  // Replace the least recently used entry. Processes still mapping
+  // its page keep their own references.
+  acquire(&textcache.lock);
+  old          = victim->mem;
+  victim->gen  = ip->textgen;
+  victim->off  = off;
+  victim->n    = n;
+  victim->mem  = mem;
+  victim->used = ++textcache.clock;
+  kref(mem);
+  release(&textcache.lock);
+  if (old)
+    kfree(old);
+  return mem;
+}
+
+// Forget the cached pages of ip because its contents are changing:
+// the next textload() gives ip a new generation, and the entries of
+// the old one are never found again. Caller holds ip->lock.
+void
+textinval(struct inode* ip)
+{
+  ip->text = 0;
+}
+
+// Report text cache lookups for kmemstat.
+void
+textstat(struct kmemstat* st)
+{
+  acquire(&textcache.lock);
+  st->texthit  = textcache.hit;
+  st->textmiss = textcache.miss;
+  release(&textcache.lock);
+}
+
+// Map the page at va from p's executable, along with up to
+// EXECREADAHEAD following pages of the same segment that are not
+// loaded yet. Pages backed by the file come from the text cache and
+// are mapped copy-on-write; the rest of the segment gets private zero
+// pages. p is a pgroup master. May sleep, so the caller must not
+// hold any spinlock. Returns -1 if the page could not be loaded.
+int
+execfault(struct proc* p, uint va)
+{
+  struct execseg* seg;
+  uint a, end, n;
+  pte_t* pte;
+  char* mem;
+  int perm, r = 0;
+
+  if ((seg = execseg(p, va)) == 0)
+    return -1;
+
+  a   = PGROUNDDOWN(va);
+  end = PGROUNDUP(seg->vaddr + seg->memsz);
+  if (end > a + (1 + EXECREADAHEAD) * PGSIZE)
+    end = a + (1 + EXECREADAHEAD) * PGSIZE;
+
+  ilock(p->execip);
+  for (; a < end; a += PGSIZE)
+  {
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if (pte && (*pte & PTE_P))
+    {
+      // Loaded by another LWP; read-ahead stops at loaded pages.
+      if (a == PGROUNDDOWN(va))
+        continue;
+      break;
+    }
+
+    n = 0;
+    if (a < seg->vaddr + seg->filesz)
+    {
+      n = seg->vaddr + seg->filesz - a;
+      if (n > PGSIZE)
+        n = PGSIZE;
+    }
+    if (n > 0)
+    {
+      mem  = textload(p->execip, seg->off + (a - seg->vaddr), n);
+      perm = PTE_U | PTE_COW;
+    }
+    else
+    {
+      mem  = kalloc_zeroed();
+      perm = PTE_W | PTE_U;
+    }
+    if (mem == 0)
+    {
+      r = (a == PGROUNDDOWN(va)) ? -1 : 0;
+      break;
+    }
+
+    acquire(&cowlock);
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if (pte && (*pte & PTE_P))
+      kfree(mem);
+    else if (mappages(p->pgdir, (char*)a, PGSIZE, V2P(mem), perm) < 0)
+    {
+      kfree(mem);
+      r = (a == PGROUNDDOWN(va)) ? -1 : 0;
+      release(&cowlock);
+      break;
+    }
+    release(&cowlock);
+  }
+  iunlock(p->execip);
+  return r;
+}
+
+// Load the pages of [va, va+n) that are still in the executable,
+// so that a system call can touch them while holding spinlocks.
+// Returns -1 if one of them could not be loaded.
+int
+prefault(uint va, uint n)
+{
+  struct proc* p = myproc()->pgroup_master;
+  pte_t* pte;
+  uint a;
+
+  if (p->nexecseg == 0)
+    return 0;
+  for (a = PGROUNDDOWN(va); a < va + n; a += PGSIZE)
+  {
+    if (execseg(p, a) == 0)
+      continue;
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if ((pte == 0 || !(*pte & PTE_P)) && execfault(p, a) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Handle a write to the copy-on-write page at va: give pgdir
+// its own writable copy, or just make the page writable if
+// pgdir holds the only reference. Returns -1 if va is not a
+// copy-on-write page or memory is exhausted.
+int
+cowfault(pde_t* pgdir, uint va)
+{
+  pte_t* pte;
+  uint pa;
+  char* mem;
+
+  if (va >= KERNBASE)
+    return -1;
+
+  acquire(&cowlock);
+  pte = walkpgdir(pgdir, (char*)va, 0);
+  if (pte == 0 || (*pte & (PTE_P | PTE_U)) != (PTE_P | PTE_U))
+  {
+    release(&cowlock);
+    return -1;
+  }
+  if (*pte & PTE_W)
+  {
+    // Another LWP got here first; this cpu had a stale TLB entry.
+    release(&cowlock);
+    tlbflush(pgdir);
+    return 0;
+  }
+  if (!(*pte & PTE_COW))
+  {
+    release(&cowlock);
+    return -1;
+  }
+
+  pa = PTE_ADDR(*pte);
+  if (krefcount(P2V(pa)) == 1)
+    *pte = (*pte | PTE_W) & ~PTE_COW;
+  else
+  {
+    if ((mem = kalloc()) == 0)
+    {
+      release(&cowlock);
+      return -1;
+    }
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    *pte = V2P(mem) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+    kfree(P2V(pa));
+  }
+  release(&cowlock);
+  tlbflush(pgdir);
+  return 0;
+}
+
 // PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -452,7 +994,7 @@ uva2ka(pde_t* pgdir, char* uva)
   pte_t* pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if ((*pte & PTE_P) == 0)
+  if (pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if ((*pte & PTE_U) == 0)
     return 0;
@@ -467,11 +1009,15 @@ copyout(pde_t* pgdir, uint va, void* p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t* pte;
 
   buf = (char*)p;
   while (len > 0)
   {
     va0 = (uint)PGROUNDDOWN(va);
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if (pte && (*pte & PTE_COW) && cowfault(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if (pa0 == 0)
       return -1;
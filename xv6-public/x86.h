@@ -12,6 +12,15 @@ inb(ushort port)
   return data;
 }
 
+static inline uint
+inl(ushort port)
+{
+  uint data;
+
+  asm volatile("in %1,%0" : "=a"(data) : "d"(port));
+  return data;
+}
+
 static inline void
 insl(int port, void* addr, int cnt)
 {
@@ -33,6 +42,12 @@ outw(ushort port, ushort data)
   asm volatile("out %0,%1" : : "a"(data), "d"(port));
 }
 
+static inline void
+outl(ushort port, uint data)
+{
+  asm volatile("out %0,%1" : : "a"(data), "d"(port));
+}
+
 static inline void
 outsl(int port, const void* addr, int cnt)
 {
@@ -120,6 +135,39 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and halt until the next one arrives.
+// sti delays interrupt delivery by one instruction, so an interrupt
+// that is already pending still wakes the hlt.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt");
+}
+
+static inline uint64
+rdtsc(void)
+{
+  uint64 val;
+
+  asm volatile("rdtsc" : "=A"(val));
+  return val;
+}
+
+// 64-bit by 32-bit unsigned division with two divl instructions;
+// the kernel is not linked against libgcc's __udivdi3.
+static inline uint64
+divu64(uint64 n, uint d)
+{
+  uint hi = n >> 32;
+  uint lo = n;
+  uint qhi, qlo, r;
+
+  qhi = hi / d;
+  r   = hi % d;
+  asm("divl %4" : "=a"(qlo), "=d"(r) : "a"(lo), "d"(r), "rm"(d));
+  return ((uint64)qhi << 32) | qlo;
+}
+
 static inline uint
 xchg(volatile uint* addr, uint newval)
 {
@@ -147,6 +195,14 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r"(val));
 }
 
+static inline uint
+rcr3(void)
+{
+  uint val;
+  asm volatile("movl %%cr3,%0" : "=r"(val));
+  return val;
+}
+
 // PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().